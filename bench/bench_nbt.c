@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ast.h>
+#include <compress.h>
+#include <decompress.h>
+#include <input.h>
+#include <parse.h>
+#include <print.h>
+
+//// MACROS ////
+
+#define DEFAULT_RUNS 3
+
+//// STRUCTS ////
+
+typedef struct Phase_s
+{
+    const char *name;
+    double seconds;
+    size_t bytes;
+} Phase_t;
+
+//// DECLARATIONS ////
+
+static double now();
+static size_t count_tags(Tag_t *tag, uint8_t type);
+static void report(const char *path, size_t compressed, size_t tags,
+                   Phase_t *phases, int count);
+static int bench_file(const char *path, int runs, FILE *null);
+
+//// DEFINITIONS ////
+
+int main(int argc, const char **argv)
+{
+    int runs = DEFAULT_RUNS;
+    int status = 0;
+
+    FILE *null = fopen("/dev/null", "wb");
+    if (!null) {
+        fprintf(stderr, "Can't open /dev/null.\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (bench_file(argv[i], runs > 0 ? runs : 1, null))
+            status = 1;
+    }
+
+    ast_end();
+    nbt_decompress_end();
+    nbt_compress_end();
+    fclose(null);
+    return status;
+}
+
+static int bench_file(const char *path, int runs, FILE *null)
+{
+    Phase_t phases[] = {
+        {"inflate", 0, 0}, {"decode", 0, 0},    {"print", 0, 0},
+        {"parse", 0, 0},   {"serialise", 0, 0}, {"deflate", 0, 0},
+    };
+    Input_t input;
+
+    if (input_open(&input, path))
+        return -1;
+
+    const uint8_t *raw = input.data;
+    uint8_t *inflated = NULL;
+    size_t raw_length = input.length;
+    char *text = NULL;
+    size_t text_length = 0;
+    Named_tag_t *tag = NULL;
+
+    // Every phase keeps the fastest of its runs
+    for (int run = 0; run < runs; run++) {
+        double start;
+
+        if (nbt_is_compressed(input.data, input.length)) {
+            free(inflated);
+            start = now();
+            int failed = nbt_inflate(input.data, input.length, &inflated,
+                                     &raw_length);
+            double inflate = now() - start;
+            if (failed) {
+                print_decode_error(get_decode_error());
+                input_close(&input);
+                return -1;
+            }
+            if (!run || inflate < phases[0].seconds)
+                phases[0].seconds = inflate;
+            raw = inflated;
+        }
+        phases[0].bytes = raw_length;
+
+        if (tag) free_nbt_tag(tag);
+        start = now();
+        tag = nbt_decode(raw, raw_length);
+        double decode = now() - start;
+        if (!tag) {
+            print_decode_error(get_decode_error());
+            free(inflated);
+            input_close(&input);
+            return -1;
+        }
+        if (!run || decode < phases[1].seconds)
+            phases[1].seconds = decode;
+        phases[1].bytes = raw_length;
+
+        free(text);
+        FILE *stream = open_memstream(&text, &text_length);
+        start = now();
+        print_nbt_tag(tag, stream);
+        fflush(stream);
+        double print = now() - start;
+        fclose(stream);
+        if (!run || print < phases[2].seconds)
+            phases[2].seconds = print;
+        phases[2].bytes = text_length;
+
+        start = now();
+        Named_tag_t *parsed = parse_nbt_tag(text, text_length);
+        double parse = now() - start;
+        if (parsed) free_nbt_tag(parsed);
+        if (!run || parse < phases[3].seconds)
+            phases[3].seconds = parse;
+        phases[3].bytes = text_length;
+
+        const uint8_t *serialised;
+        size_t serialised_length;
+        start = now();
+        nbt_serialise(tag, &serialised, &serialised_length);
+        double serialise = now() - start;
+        if (!run || serialise < phases[4].seconds)
+            phases[4].seconds = serialise;
+        phases[4].bytes = serialised_length;
+
+        start = now();
+        nbt_deflate(serialised, serialised_length, null);
+        double deflate = now() - start;
+        if (!run || deflate < phases[5].seconds)
+            phases[5].seconds = deflate;
+        phases[5].bytes = serialised_length;
+    }
+
+    size_t tags = 1 + count_tags(tag->tag, tag->type);
+    int first = nbt_is_compressed(input.data, input.length) ? 0 : 1;
+    report(path, input.length, tags, phases + first,
+           sizeof(phases) / sizeof(*phases) - first);
+
+    free_nbt_tag(tag);
+    free(text);
+    free(inflated);
+    input_close(&input);
+    return 0;
+}
+
+static void report(const char *path, size_t compressed, size_t tags,
+                   Phase_t *phases, int count)
+{
+    printf("%s: %.1f MiB in, %.1f MiB NBT, %zu tags\n", path,
+           compressed / 1048576.0, phases[count - 1].bytes / 1048576.0, tags);
+    printf("  %-10s %10s %10s %10s\n", "phase", "ms", "MB/s", "Mtags/s");
+    for (int i = 0; i < count; i++) {
+        double seconds = phases[i].seconds > 0 ? phases[i].seconds : 1e-9;
+        printf("  %-10s %10.2f %10.1f %10.2f\n", phases[i].name,
+               seconds * 1e3, phases[i].bytes / seconds / 1e6,
+               tags / seconds / 1e6);
+    }
+    printf("\n");
+}
+
+static size_t count_tags(Tag_t *tag, uint8_t type)
+{
+    size_t count = 0;
+
+    if (type == TAG_Compound) {
+        Tag_compound_t *compound = (Tag_compound_t *) tag;
+        for (int i = 0; compound->load[i]; i++) {
+            Named_tag_t *member = compound->load[i];
+            count += 1 + count_tags(member->tag, member->type);
+        }
+    }
+    else if (type == TAG_List) {
+        Tag_list_t *list = (Tag_list_t *) tag;
+        for (int i = 0; i < list->length; i++)
+            count += 1 + count_tags(list->load[i], list->list_type);
+    }
+    return count;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
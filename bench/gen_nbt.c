@@ -0,0 +1,484 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+//// MACROS ////
+
+#define OUT_CHUNK 0x10000
+#define MIB       (1024 * 1024)
+
+#define SECTIONS_PER_CHUNK 24
+#define ENTITIES_PER_LIST  256
+#define ITEMS_PER_LIST     64
+#define NESTING_DEPTH      255
+
+enum TAG_TYPE
+{
+    TAG_End,        //  0
+    TAG_Byte,       //  1
+    TAG_Short,      //  2
+    TAG_Int,        //  3
+    TAG_Long,       //  4
+    TAG_Float,      //  5
+    TAG_Double,     //  6
+    TAG_Byte_Array, //  7
+    TAG_String,     //  8
+    TAG_List,       //  9
+    TAG_Compound,   // 10
+    TAG_Int_Array,  // 11
+    TAG_Long_Array, // 12
+};
+
+//// VARIABLES ////
+
+static gzFile out;
+static uint8_t out_buf[OUT_CHUNK];
+static size_t buf_index = 0;
+static uint64_t written = 0;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static const char *blocks[] = {
+    "stone",         "dirt",         "grass_block",   "deepslate",
+    "andesite",      "diorite",      "granite",       "gravel",
+    "water",         "lava",         "coal_ore",      "iron_ore",
+    "copper_ore",    "gold_ore",     "redstone_ore",  "diamond_ore",
+    "oak_log",       "oak_leaves",   "birch_log",     "spruce_planks",
+    "torch",         "chest",        "hopper",        "rail",
+    "glass",         "sand",         "sandstone",     "tuff",
+    "cobblestone",   "mossy_cobblestone", "bedrock",  "air",
+};
+
+static const char *biomes[] = {
+    "plains", "forest", "river", "ocean", "desert", "taiga", "swamp",
+    "dripstone_caves",
+};
+
+static const char *entities[] = {
+    "villager", "zombie", "skeleton", "creeper", "cow", "sheep", "pig",
+    "chicken", "item", "armor_stand", "item_frame", "minecart",
+};
+
+static const char *words[] = {
+    "the",    "of",       "and",     "a",       "to",      "in",
+    "is",     "you",      "that",    "it",      "he",      "was",
+    "for",    "on",       "are",     "as",      "with",    "his",
+    "they",   "village",  "diamond", "redstone", "castle", "dragon",
+    "nether", "portal",   "café",    "über",    "naïve",   "señor",
+};
+
+//// DECLARATIONS ////
+
+static uint64_t rng();
+static uint32_t rng_below(uint32_t n);
+
+static void flush();
+static void put8(uint8_t c);
+static void put16(uint16_t n);
+static void put32(uint32_t n);
+static void put64(uint64_t n);
+static void put_float(float n);
+static void put_double(double n);
+static void put_string(const char *str);
+static void put_name(uint8_t type, const char *name);
+static void put_list(uint8_t type, int32_t length);
+
+static void gen_chunk(const char *name, int index);
+static void gen_entities(const char *name, int index);
+static void gen_deep(const char *name, int index);
+static void gen_strings(const char *name, int index);
+
+//// DEFINITIONS ////
+
+int main(int argc, const char **argv)
+{
+    static const struct {
+        const char *kind;
+        void (*generate)(const char *, int);
+    } kinds[] = {
+        {"chunk", gen_chunk},
+        {"entity", gen_entities},
+        {"deep", gen_deep},
+        {"string", gen_strings},
+    };
+
+    if (argc != 4) {
+        fprintf(stderr,
+                "Usage: %s {chunk|entity|deep|string} size_mib output_file\n"
+                "\n"
+                "Generates a gzip NBT document of roughly size_mib MiB "
+                "(uncompressed).\n",
+                argv[0]);
+        return 1;
+    }
+
+    void (*generate)(const char *, int) = NULL;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(*kinds); i++) {
+        if (!strcmp(argv[1], kinds[i].kind))
+            generate = kinds[i].generate;
+    }
+    if (!generate) {
+        fprintf(stderr, "Unknown kind \"%s\".\n", argv[1]);
+        return 1;
+    }
+
+    uint64_t target = strtoull(argv[2], NULL, 10) * MIB;
+    out = gzopen(argv[3], "wb");
+    if (!out) {
+        fprintf(stderr, "Can't open \"%s\".\n", argv[3]);
+        return 1;
+    }
+
+    // Members of the root compound aren't counted up front, so the document
+    // can keep growing until it reaches the requested size
+    put_name(TAG_Compound, "");
+    for (int i = 0; written + buf_index < target; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s_%d", argv[1], i);
+        generate(name, i);
+    }
+    put8(TAG_End);
+
+    flush();
+    gzclose(out);
+    return 0;
+}
+
+static void gen_chunk(const char *name, int index)
+{
+    put_name(TAG_Compound, name);
+
+    put_name(TAG_Int, "DataVersion");
+    put32(3465);
+    put_name(TAG_Int, "xPos");
+    put32(index % 32);
+    put_name(TAG_Int, "zPos");
+    put32(index / 32);
+    put_name(TAG_String, "Status");
+    put_string("minecraft:full");
+    put_name(TAG_Long, "LastUpdate");
+    put64(rng() >> 20);
+
+    put_name(TAG_Compound, "Heightmaps");
+    put_name(TAG_Long_Array, "MOTION_BLOCKING");
+    put32(37);
+    for (int i = 0; i < 37; i++) put64(rng());
+    put_name(TAG_Long_Array, "WORLD_SURFACE");
+    put32(37);
+    for (int i = 0; i < 37; i++) put64(rng());
+    put8(TAG_End);
+
+    put_name(TAG_List, "sections");
+    put_list(TAG_Compound, SECTIONS_PER_CHUNK);
+    for (int y = 0; y < SECTIONS_PER_CHUNK; y++) {
+        put_name(TAG_Byte, "Y");
+        put8(y - 4);
+
+        // Palettes of up to 32 entries, packed the post-1.16 way
+        int palette = 1 + rng_below(32);
+        int bits = 4;
+        while ((1 << bits) < palette) bits++;
+        int per_long = 64 / bits;
+
+        put_name(TAG_Compound, "block_states");
+        put_name(TAG_List, "palette");
+        put_list(TAG_Compound, palette);
+        for (int i = 0; i < palette; i++) {
+            char block[64];
+            snprintf(block, sizeof(block), "minecraft:%s",
+                     blocks[rng_below(sizeof(blocks) / sizeof(*blocks))]);
+            put_name(TAG_String, "Name");
+            put_string(block);
+            if (rng_below(3) == 0) {
+                put_name(TAG_Compound, "Properties");
+                put_name(TAG_String, "facing");
+                put_string("north");
+                put_name(TAG_String, "waterlogged");
+                put_string("false");
+                put8(TAG_End);
+            }
+            put8(TAG_End);
+        }
+        if (palette > 1) {
+            int longs = (4096 + per_long - 1) / per_long;
+            put_name(TAG_Long_Array, "data");
+            put32(longs);
+            for (int i = 0; i < longs; i++) {
+                uint64_t packed = 0;
+                for (int j = 0; j < per_long; j++)
+                    packed |= (uint64_t) rng_below(palette) << (j * bits);
+                put64(packed);
+            }
+        }
+        put8(TAG_End);
+
+        put_name(TAG_Compound, "biomes");
+        put_name(TAG_List, "palette");
+        put_list(TAG_String, 2);
+        put_string("minecraft:plains");
+        put_string(biomes[rng_below(sizeof(biomes) / sizeof(*biomes))]);
+        put_name(TAG_Long_Array, "data");
+        put32(1);
+        put64(rng());
+        put8(TAG_End);
+
+        put_name(TAG_Byte_Array, "BlockLight");
+        put32(2048);
+        for (int i = 0; i < 2048; i++) put8(rng_below(16) * 17);
+        put_name(TAG_Byte_Array, "SkyLight");
+        put32(2048);
+        for (int i = 0; i < 2048; i++) put8(0xFF);
+
+        put8(TAG_End);
+    }
+
+    int chests = rng_below(4);
+    put_name(TAG_List, "block_entities");
+    put_list(chests ? TAG_Compound : TAG_End, chests);
+    for (int i = 0; i < chests; i++) {
+        put_name(TAG_String, "id");
+        put_string("minecraft:chest");
+        put_name(TAG_Int, "x");
+        put32(rng_below(16));
+        put_name(TAG_Int, "y");
+        put32(rng_below(320));
+        put_name(TAG_Int, "z");
+        put32(rng_below(16));
+        put_name(TAG_List, "Items");
+        put_list(TAG_Compound, 27);
+        for (int slot = 0; slot < 27; slot++) {
+            char item[64];
+            snprintf(item, sizeof(item), "minecraft:%s",
+                     blocks[rng_below(sizeof(blocks) / sizeof(*blocks))]);
+            put_name(TAG_Byte, "Slot");
+            put8(slot);
+            put_name(TAG_String, "id");
+            put_string(item);
+            put_name(TAG_Byte, "Count");
+            put8(1 + rng_below(64));
+            put8(TAG_End);
+        }
+        put8(TAG_End);
+    }
+
+    put8(TAG_End);
+}
+
+static void gen_entities(const char *name, int index)
+{
+    put_name(TAG_List, name);
+    put_list(TAG_Compound, ENTITIES_PER_LIST);
+
+    for (int e = 0; e < ENTITIES_PER_LIST; e++) {
+        char id[64];
+        snprintf(id, sizeof(id), "minecraft:%s",
+                 entities[rng_below(sizeof(entities) / sizeof(*entities))]);
+
+        put_name(TAG_String, "id");
+        put_string(id);
+
+        put_name(TAG_List, "Pos");
+        put_list(TAG_Double, 3);
+        for (int i = 0; i < 3; i++) put_double(rng_below(60000) / 3.0);
+        put_name(TAG_List, "Motion");
+        put_list(TAG_Double, 3);
+        for (int i = 0; i < 3; i++) put_double(rng_below(100) / 1000.0);
+        put_name(TAG_List, "Rotation");
+        put_list(TAG_Float, 2);
+        for (int i = 0; i < 2; i++) put_float(rng_below(360));
+
+        put_name(TAG_Float, "FallDistance");
+        put_float(0);
+        put_name(TAG_Short, "Fire");
+        put16(-1);
+        put_name(TAG_Short, "Air");
+        put16(300);
+        put_name(TAG_Byte, "OnGround");
+        put8(1);
+        put_name(TAG_Int_Array, "UUID");
+        put32(4);
+        for (int i = 0; i < 4; i++) put32(rng());
+        put_name(TAG_Float, "Health");
+        put_float(1 + rng_below(20));
+
+        put_name(TAG_List, "Attributes");
+        put_list(TAG_Compound, 3);
+        put_name(TAG_String, "Name");
+        put_string("minecraft:generic.max_health");
+        put_name(TAG_Double, "Base");
+        put_double(20);
+        put8(TAG_End);
+        put_name(TAG_String, "Name");
+        put_string("minecraft:generic.movement_speed");
+        put_name(TAG_Double, "Base");
+        put_double(0.5);
+        put8(TAG_End);
+        put_name(TAG_String, "Name");
+        put_string("minecraft:generic.follow_range");
+        put_name(TAG_Double, "Base");
+        put_double(48);
+        put8(TAG_End);
+
+        int tags = rng_below(3);
+        put_name(TAG_List, "Tags");
+        put_list(tags ? TAG_String : TAG_End, tags);
+        for (int i = 0; i < tags; i++)
+            put_string(i ? "tracked" : "spawned_by_egg");
+
+        put_name(TAG_Compound, "Brain");
+        put_name(TAG_Compound, "memories");
+        put8(TAG_End);
+        put8(TAG_End);
+
+        put8(TAG_End);
+    }
+}
+
+static void gen_deep(const char *name, int index)
+{
+    // Compounds and single-element lists alternate all the way down, as deep
+    // as the decoder allows by default
+    put_name(TAG_Compound, name);
+    for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+        put_name(TAG_Int, "depth");
+        put32(depth);
+        put_name(TAG_List, "child");
+        put_list(TAG_Compound, 1);
+    }
+    put_name(TAG_String, "leaf");
+    put_string("bottom");
+    for (int depth = 0; depth <= NESTING_DEPTH; depth++)
+        put8(TAG_End);
+}
+
+static void gen_strings(const char *name, int index)
+{
+    put_name(TAG_List, name);
+    put_list(TAG_Compound, ITEMS_PER_LIST);
+
+    for (int item = 0; item < ITEMS_PER_LIST; item++) {
+        char text[1024];
+
+        put_name(TAG_String, "id");
+        put_string("minecraft:written_book");
+        put_name(TAG_Byte, "Count");
+        put8(1);
+
+        put_name(TAG_Compound, "tag");
+        put_name(TAG_String, "title");
+        put_string("A Tale of Two Villages");
+        put_name(TAG_String, "author");
+        put_string("Steve");
+
+        int pages = 4 + rng_below(12);
+        put_name(TAG_List, "pages");
+        put_list(TAG_String, pages);
+        for (int p = 0; p < pages; p++) {
+            size_t length = 0;
+            int target = 100 + rng_below(600);
+            length += snprintf(text, sizeof(text), "{\"text\":\"");
+            while (length < (size_t) target) {
+                const char *word =
+                    words[rng_below(sizeof(words) / sizeof(*words))];
+                length += snprintf(text + length, sizeof(text) - length,
+                                   "%s ", word);
+            }
+            snprintf(text + length, sizeof(text) - length, "\\n\"}");
+            put_string(text);
+        }
+
+        put_name(TAG_Compound, "display");
+        put_name(TAG_String, "Name");
+        put_string("{\"text\":\"Journal\",\"italic\":false,"
+                   "\"color\":\"gold\"}");
+        put_name(TAG_List, "Lore");
+        put_list(TAG_String, 2);
+        put_string("{\"text\":\"Found in a stronghold\"}");
+        put_string("{\"text\":\"Do not \\\"open\\\"\"}");
+        put8(TAG_End);
+
+        put8(TAG_End);
+        put8(TAG_End);
+    }
+}
+
+static uint64_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint32_t rng_below(uint32_t n)
+{
+    return (uint32_t) ((rng() >> 32) % n);
+}
+
+static void flush()
+{
+    if (buf_index && gzwrite(out, out_buf, buf_index) != (int) buf_index) {
+        fprintf(stderr, "Write error.\n");
+        exit(1);
+    }
+    written += buf_index;
+    buf_index = 0;
+}
+
+static void put8(uint8_t c)
+{
+    if (buf_index == OUT_CHUNK) flush();
+    out_buf[buf_index++] = c;
+}
+
+static void put16(uint16_t n)
+{
+    put8(n >> 8);
+    put8(n);
+}
+
+static void put32(uint32_t n)
+{
+    put16(n >> 16);
+    put16(n);
+}
+
+static void put64(uint64_t n)
+{
+    put32(n >> 32);
+    put32(n);
+}
+
+static void put_float(float n)
+{
+    uint32_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    put32(bits);
+}
+
+static void put_double(double n)
+{
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    put64(bits);
+}
+
+static void put_string(const char *str)
+{
+    size_t length = strlen(str);
+    put16(length);
+    for (size_t i = 0; i < length; i++) put8(str[i]);
+}
+
+static void put_name(uint8_t type, const char *name)
+{
+    put8(type);
+    put_string(name);
+}
+
+static void put_list(uint8_t type, int32_t length)
+{
+    put8(type);
+    put32(length);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 //// DECLARATIONS AND TYPEDEFS ////
 
@@ -21,6 +23,47 @@ enum TAG_TYPE
     TAG_Long_Array, // 12
 };
 
+// How binary NBT lays out numbers. Java Edition is big-endian and Bedrock
+// Edition little-endian, and Bedrock's network form also writes ints, longs
+// and lengths as varints.
+enum NBT_FORMAT
+{
+    NBT_JAVA,
+    NBT_BEDROCK,
+    NBT_NETWORK,
+};
+
+// Initial number of members the shared builder stack has room for
+#define BUILDER_PREALLOC 0x100
+#define WALK_PREALLOC    32
+
+// Allocation accounting kinds, besides the tag types themselves
+#define ALLOC_NAMED   13
+#define ALLOC_BUILDER 14
+#define ALLOC_KINDS   15
+
+typedef struct Alloc_counter_s
+{
+    size_t bytes;
+    size_t objects;
+    size_t peak_bytes;
+    size_t total_bytes;
+    size_t total_objects;
+} Alloc_counter_t;
+
+// Building with -DAST_ACCOUNTING counts every allocation made for the tree.
+// Without it these are plain malloc, realloc and free.
+#ifdef AST_ACCOUNTING
+void *ast_malloc(uint8_t kind, uint8_t object, size_t size);
+void *ast_realloc(void *ptr, size_t size);
+void ast_free(void *ptr);
+size_t ast_accounting(Alloc_counter_t counters[ALLOC_KINDS]);
+#else
+#define ast_malloc(kind, object, size) malloc(size)
+#define ast_realloc(ptr, size)         realloc(ptr, size)
+#define ast_free(ptr)                  free(ptr)
+#endif
+
 typedef struct Tag_s
 {
     uint8_t type;
@@ -75,7 +118,7 @@ typedef struct Tag_string_s
 {
     uint8_t type;
     int8_t *load;
-    int16_t length;
+    uint16_t length;
 } Tag_string_t;
 
 typedef struct Tag_list_s
@@ -113,17 +156,23 @@ typedef struct Tag_long_array_s
     int32_t length;
 } Tag_long_array_t;
 
-typedef struct Compound_node_s
+// Members of the compound or list being built. They are kept on a shared
+// per-thread stack until the container is finalised, so nested containers
+// and siblings all reuse the same memory.
+typedef struct Builder_s
 {
-    Named_tag_t *tag;
-    struct Compound_node_s *previous;
-} Compound_node_t;
+    size_t start;
+} Builder_t;
 
-typedef struct List_node_s
+// A compound or list being traversed, and the index of its next member.
+// Traversals share one stack per thread and only touch frames above the
+// depth they started at.
+typedef struct Walk_frame_s
 {
+    uint8_t type;
     Tag_t *tag;
-    struct List_node_s *previous;
-} List_node_t;
+    int32_t index;
+} Walk_frame_t;
 
 //// FUNCTIONS ////
 
@@ -151,13 +200,13 @@ void free_tag_double(Tag_t *);
 Tag_byte_array_t *new_byte_array(int32_t);
 void free_tag_byte_array(Tag_t *);
 
-Tag_string_t *new_string(int16_t);
+Tag_string_t *new_string(uint16_t);
 void free_tag_string(Tag_t *);
 
 Tag_list_t *new_list(int8_t, int32_t);
 void free_tag_list(Tag_t *);
 
-Tag_compound_t *new_compound(Compound_node_t *);
+Tag_compound_t *new_compound(Builder_t *);
 void free_tag_compound(Tag_t *);
 
 Tag_int_array_t *new_int_array(int32_t);
@@ -171,10 +220,17 @@ void free_named_tag(Named_tag_t *);
 
 void free_nbt_tag(Named_tag_t *tag);
 
-Compound_node_t *new_compound_list();
-Compound_node_t *add_compound_node(Compound_node_t *, Named_tag_t *);
-Named_tag_t **finalise_compound_list(Compound_node_t *);
+Tag_t *compound_get(const Tag_t *compound, const char *name, uint8_t type);
+
+Builder_t new_builder();
+void builder_add(Builder_t *, void *);
+size_t builder_length(const Builder_t *);
+Named_tag_t **finalise_compound_builder(Builder_t *);
+Tag_list_t *finalise_list_builder(int8_t, Builder_t *);
+
+Walk_frame_t *walk_push(uint8_t type, Tag_t *tag);
+Walk_frame_t *walk_top();
+void walk_pop();
+size_t walk_depth();
 
-List_node_t *new_nodes_list();
-List_node_t *add_list_node(List_node_t *, Tag_t *);
-Tag_list_t *finalise_nodes_list(int8_t, List_node_t *);
+void ast_end();
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <census.h>
+#include <stats.h>
+
+//// MACROS ////
+
+#define TEXT_EXTENSION   ".snbt"
+#define BINARY_EXTENSION ".nbt"
+#define TEMP_EXTENSION   ".tmp"
+
+//// STRUCTS ////
+
+typedef struct Convert_options_s
+{
+    uint8_t parse;
+    uint8_t compr;
+    uint8_t snapshot;
+    uint8_t region;
+    uint8_t blocks;
+    int threads;
+    Stats_t *stats;
+    Census_t *census;
+    const char *get;
+} Convert_options_t;
+
+typedef struct Batch_job_s
+{
+    char *path;
+    char *name;
+} Batch_job_t;
+
+typedef struct Batch_s
+{
+    Batch_job_t *jobs;
+    size_t length;
+    size_t capacity;
+
+    Convert_options_t options;
+    const char *output_dir;
+    int threads;
+
+    atomic_size_t failed;
+    atomic_size_t finished;
+} Batch_t;
+
+//// DECLARATIONS ////
+
+int convert_file(const char *path, FILE *stream, const Convert_options_t *);
+
+void batch_init(Batch_t *);
+int batch_add_path(Batch_t *, const char *path);
+int batch_add_list(Batch_t *, const char *list_path);
+int batch_run(Batch_t *);
+void batch_free(Batch_t *);
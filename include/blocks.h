@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ast.h>
+
+//// MACROS ////
+
+#define SECTION_SIDE   16
+#define SECTION_BLOCKS 4096
+#define BLOCK_MIN_BITS 4
+#define BLOCK_MAX_BITS 12
+
+// Entries unpacked per vector step
+#define UNPACK_STEP 8
+
+enum BLOCKS_MODE
+{
+    BLOCKS_OFF,
+    BLOCKS_HISTOGRAM,
+    BLOCKS_PALETTE,
+};
+
+//// DECLARATIONS ////
+
+int blocks_bits(size_t palette_length);
+int blocks_unpack(const int64_t *data, size_t length, int bits,
+                  uint16_t out[SECTION_BLOCKS]);
+Tag_list_t *blocks_sections(Named_tag_t *chunk, Tag_t **position);
+int blocks_section(Tag_t *section, Tag_list_t **palette,
+                   uint16_t out[SECTION_BLOCKS]);
+int blocks_print(Named_tag_t *chunk, int mode, FILE *stream);
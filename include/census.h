@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ast.h>
+
+//// MACROS ////
+
+// Slots a table starts with, always a power of two
+#define CENSUS_PREALLOC 0x100
+
+enum CENSUS_KIND
+{
+    CENSUS_BLOCKS,
+    CENSUS_ENTITIES,
+    CENSUS_BLOCK_ENTITIES,
+    CENSUS_KINDS,
+};
+
+//// STRUCTS ////
+
+typedef struct Census_entry_s
+{
+    char *name;
+    size_t length;
+    uint64_t hash;
+    uint64_t count;
+} Census_entry_t;
+
+// Open addressing over names, with empty slots left NULL
+typedef struct Census_table_s
+{
+    Census_entry_t *entries;
+    size_t capacity;
+    size_t length;
+} Census_table_t;
+
+typedef struct Census_s
+{
+    Census_table_t tables[CENSUS_KINDS];
+    size_t chunks;
+} Census_t;
+
+//// VARIABLES ////
+
+extern const char *const census_paths[];
+
+//// DECLARATIONS ////
+
+void census_init(Census_t *);
+int census_count(Named_tag_t *chunk);
+void census_end(Census_t *into);
+void census_print(const Census_t *, FILE *stream);
+void census_free(Census_t *);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <ast.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdint.h>
 
 //// MACROS ////
@@ -9,11 +11,29 @@
 #define windowBits  15
 #define ENABLE_GZIP 16
 
+#define PARALLEL_BLOCK        0x20000
+#define PARALLEL_DICT         0x8000
+#define PARALLEL_MIN_SIZE     (4 * PARALLEL_BLOCK)
+#define PARALLEL_FLUSH_MARGIN 16
+
+#define GZIP_HEADER_SIZE  10
+#define GZIP_TRAILER_SIZE 8
+#define GZIP_OS_UNIX      3
+
 //// DECLARATIONS ////
 
-void nbt_compress(Named_tag_t *);
+int nbt_compress(Named_tag_t *, FILE *stream);
+int nbt_serialise(Named_tag_t *, const uint8_t **data, size_t *length);
+int nbt_deflate(const uint8_t *data, size_t length, FILE *stream);
+int nbt_deflate_zlib(const uint8_t *data, size_t length, const uint8_t **out,
+                     size_t *out_length);
+int nbt_deflate_parallel(const uint8_t *data, size_t length, FILE *stream,
+                         int threads);
+void nbt_set_write_format(uint8_t format);
+void nbt_set_write_nameless(uint8_t nameless);
+void nbt_compress_end();
 
-void write_nbt_tag(Named_tag_t *);
+int write_nbt_tag(Named_tag_t *);
 void write_TAG(Named_tag_t *);
 
 void write_TAG_End(Tag_t *);
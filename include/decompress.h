@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ast.h>
+#include <stddef.h>
 #include <stdint.h>
 
 //// MACROS ////
@@ -9,9 +10,155 @@
 #define windowBits  15
 #define ENABLE_GZIP 16
 
+#define ENABLE_ZLIB_GZIP 32
+#define GZIP_MAGIC_0     0x1F
+#define GZIP_MAGIC_1     0x8B
+#define ZLIB_MAGIC       0x78
+
+#define GZIP_MIN_SIZE     18
+#define DEFLATE_MAX_RATIO 1032
+
+#define LIST_PREALLOC_MAX 0x1000
+
+#define DECODE_PATH_MAX 0x400
+#define PATH_INDEX_MAX  16
+
+#define STREAM_BUFFERS  4
+#define STREAM_BUFFER   0x40000
+#define STREAM_SLACK    (STREAM_BUFFERS * STREAM_BUFFER)
+#define STREAM_MIN_SIZE 0x100000
+
+// Inflating can restart at a checkpoint made every INFLATE_SPAN bytes of
+// output, given the window of output before it
+#define INFLATE_WINDOW 0x8000
+#define INFLATE_SPAN   0x400000
+#define POINT_PREALLOC 8
+
+#define DECODE_MAX_DEPTH 512
+#define FRAME_PREALLOC   32
+
+// Longest varints of 32 and 64 bits, at seven bits a byte
+#define VARINT_MAX_32 5
+#define VARINT_MAX_64 10
+
+//// STRUCTS ////
+
+enum DECODE_STATUS
+{
+    DECODE_OK,
+    DECODE_EOF,
+    DECODE_INVALID_TYPE,
+    DECODE_INVALID_LENGTH,
+    DECODE_INVALID_ROOT,
+    DECODE_INFLATE,
+    DECODE_TOO_DEEP,
+    DECODE_SEEK,
+    DECODE_INVALID_VARINT,
+    DECODE_TRAILING_DATA,
+};
+
+typedef struct Decode_error_s
+{
+    int code;
+    const char *message;
+    size_t location;
+    size_t path_start;
+    char path[DECODE_PATH_MAX];
+} Decode_error_t;
+
+typedef struct Decode_frame_s
+{
+    uint8_t type;
+    Tag_string_t *name;
+    Builder_t members;
+    Tag_list_t *list;
+    int32_t length;
+    int32_t capacity;
+
+    // Only members on a selected path are decoded below this frame
+    uint8_t selective;
+    size_t select_length;
+} Decode_frame_t;
+
+typedef struct Skip_frame_s
+{
+    uint8_t type;
+    uint8_t list_type;
+    int32_t length;
+    int32_t left;
+} Skip_frame_t;
+
+// A tag met while walking, with the offset of its payload in the inflated
+// input. List elements have an index instead of a name.
+typedef struct Nbt_node_s
+{
+    uint8_t type;
+    size_t depth;
+    const Tag_string_t *name;
+    int32_t index;
+    size_t offset;
+} Nbt_node_t;
+
+// A member name, or with a NULL name a list index
+typedef struct Path_segment_s
+{
+    const char *name;
+    size_t length;
+    int32_t index;
+} Path_segment_t;
+
+// A deflate block boundary, with in just past the byte holding the first
+// bits of the next block if bits is not 0
+typedef struct Inflate_point_s
+{
+    uint64_t in;
+    uint64_t out;
+    uint32_t window_length;
+    uint8_t bits;
+    uint8_t trailer;
+    uint8_t window[INFLATE_WINDOW];
+} Inflate_point_t;
+
+typedef struct Nbt_stream_s Nbt_stream_t;
+
 //// DECLARATIONS ////
 
-Named_tag_t *nbt_decompress();
+Named_tag_t *nbt_decompress(const uint8_t *data, size_t length);
+Named_tag_t *nbt_decompress_only(const uint8_t *data, size_t length,
+                                 const char *const *paths);
+uint8_t nbt_is_compressed(const uint8_t *data, size_t length);
+int nbt_inflate(const uint8_t *data, size_t length, uint8_t **out,
+                size_t *out_length);
+Named_tag_t *nbt_decode(const uint8_t *data, size_t length);
+Named_tag_t *nbt_decode_slice(const uint8_t *data, size_t length,
+                              size_t *used);
+Named_tag_t *nbt_decode_only(const uint8_t *data, size_t length,
+                             const char *const *paths);
+Nbt_stream_t *nbt_stream_open(const uint8_t *data, size_t length,
+                              int threads);
+Nbt_stream_t *nbt_stream_open_points(const uint8_t *data, size_t length,
+                                     int threads, size_t span);
+Nbt_stream_t *nbt_stream_resume(const uint8_t *data, size_t length,
+                                const Inflate_point_t *point);
+Named_tag_t *nbt_stream_next(Nbt_stream_t *stream);
+int nbt_stream_walk(Nbt_stream_t *stream, size_t depth,
+                    void (*visit)(void *ctx, const Nbt_node_t *node),
+                    void *ctx);
+Tag_t *nbt_stream_get(Nbt_stream_t *stream, size_t offset, uint8_t *type,
+                      const Path_segment_t *path, size_t count);
+size_t nbt_stream_offset(const Nbt_stream_t *stream);
+Inflate_point_t *nbt_stream_take_points(Nbt_stream_t *stream,
+                                        size_t *count);
+void nbt_stream_close(Nbt_stream_t *stream);
+void nbt_decompress_end();
+void nbt_set_max_depth(size_t depth);
+void nbt_set_read_format(uint8_t format);
+void nbt_set_read_nameless(uint8_t nameless);
+uint8_t nbt_read_format();
+uint8_t nbt_read_nameless();
+
+const Decode_error_t *get_decode_error();
+void print_decode_error(const Decode_error_t *);
 
 Named_tag_t *read_nbt_tag();
 Named_tag_t *read_TAG();
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ast.h>
+#include <decompress.h>
+#include <input.h>
+
+//// MACROS ////
+
+#define INDEX_EXTENSION ".nbti"
+#define INDEX_MAGIC     "NBTI"
+#define INDEX_VERSION   4
+
+// Members of the root and their own members are indexed, and anything
+// deeper is found by stepping over the bytes from there
+#define INDEX_DEPTH 2
+
+// Bytes hashed from each end of the input to tell copies apart
+#define INDEX_HASH_SPAN 0x10000
+
+#define INDEX_NONE UINT32_MAX
+
+//// STRUCTS ////
+
+// The sidecar file holds this header, the nodes, their names and then the
+// inflate checkpoints, all in native byte order, as it is only a cache for
+// the machine that made it
+typedef struct Index_header_s
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint32_t hash;
+    uint32_t depth;
+    uint32_t format;
+    uint32_t nameless;
+    uint64_t span;
+    uint64_t nodes;
+    uint64_t names_length;
+    uint64_t points;
+} Index_header_t;
+
+// A tag and the offset of its payload in the inflated input. Nodes are in
+// document order, so parents always come first.
+typedef struct Index_node_s
+{
+    uint64_t offset;
+    uint64_t name;
+    uint32_t parent;
+    uint16_t name_length;
+    uint8_t type;
+    uint8_t named;
+} Index_node_t;
+
+typedef struct Index_s
+{
+    Index_header_t header;
+    Index_node_t *nodes;
+    char *names;
+    Inflate_point_t *points;
+    size_t nodes_capacity;
+    size_t names_capacity;
+
+    // Built on load, for going down the tree
+    uint32_t *children;
+    uint32_t *siblings;
+    uint32_t *roots;
+    size_t roots_length;
+
+    uint32_t parents[INDEX_DEPTH + 1];
+} Index_t;
+
+typedef struct Index_path_s
+{
+    Path_segment_t *segments;
+    size_t length;
+    char *names;
+} Index_path_t;
+
+//// DECLARATIONS ////
+
+int index_open(Index_t *, const char *path, const Input_t *input);
+int index_get(const Index_t *, const Input_t *input, const Index_path_t *,
+              size_t root, Named_tag_t **out);
+Named_tag_t *index_result(const Index_path_t *, const char *root_name,
+                          size_t root_length, uint8_t type, Tag_t *tag);
+void index_close(Index_t *);
+
+int index_parse_path(Index_path_t *, const char *text);
+void index_free_path(Index_path_t *);
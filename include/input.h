@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//// STRUCTS ////
+
+typedef struct Input_s
+{
+    const uint8_t *data;
+    size_t length;
+    uint8_t mapped;
+} Input_t;
+
+//// DECLARATIONS ////
+
+int input_open(Input_t *, const char *path);
+void input_close(Input_t *);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//// MACROS ////
+
+// Longest sequences either way: a supplementary character is four bytes of
+// UTF-8, but a surrogate pair of three bytes each in modified UTF-8
+#define UTF8_MAX  4
+#define MUTF8_MAX 6
+
+//// DECLARATIONS ////
+
+size_t mutf8_plain(const uint8_t *data, size_t length);
+size_t mutf8_to_utf8(const uint8_t *data, size_t length,
+                     uint8_t out[UTF8_MAX], size_t *used);
+size_t utf8_to_mutf8(const uint8_t *data, size_t length,
+                     uint8_t out[MUTF8_MAX], size_t *used);
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <ast.h>
+#include <stddef.h>
 #include <stdint.h>
 
 //// MACROS ////
 
 #define CHUNK       0x1000
 #define TOTAL_TYPES 13
+#define TOKEN_MAX   63
 
 //// STRUCTS ////
 
@@ -14,17 +16,18 @@ typedef struct error_s
 {
     struct error_s *previous;
     const char *message;
-    int location;
+    size_t location;
 } error_t;
 
 //// DECLARATIONS ////
 
-void raise_error(int, const char *);
-void append_error(int, const char *);
+void raise_error(size_t, const char *);
+void append_error(size_t, const char *);
 error_t *get_error();
 void print_error(error_t *);
 
-Named_tag_t *parse_nbt_tag();
+Named_tag_t *parse_nbt_tag(const char *data, size_t length);
+void nbt_set_parse_nameless(uint8_t nameless);
 Tag_t *parse_any_data();
 Tag_string_t *parse_tag_name();
 Named_tag_t *parse_named_tag();
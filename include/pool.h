@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+//// DECLARATIONS ////
+
+int pool_threads(int requested);
+void pool_run(int threads, size_t jobs, void (*job)(void *, size_t),
+              void (*done)(void *), void *ctx);
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <ast.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // colours
 #define _CLEAR "\033[0m"
@@ -36,4 +38,4 @@ void print_tag_compound(Tag_t *ptr);
 void print_tag_int_array(Tag_t *ptr);
 void print_tag_long_array(Tag_t *ptr);
 void print_named_tag(Named_tag_t *tag);
-void print_nbt_tag(Named_tag_t *tag);
+int print_nbt_tag(Named_tag_t *tag, FILE *stream);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ast.h>
+#include <input.h>
+
+//// MACROS ////
+
+#define REGION_SECTOR      0x1000
+#define REGION_CHUNKS      1024
+#define REGION_HEADER      (2 * REGION_SECTOR)
+#define REGION_MAX_SECTORS 0xFF
+#define CHUNK_HEADER       5
+
+#define CHUNK_GZIP     1
+#define CHUNK_ZLIB     2
+#define CHUNK_NONE     3
+#define CHUNK_EXTERNAL 0x80
+
+#define REGION_EXTENSION        ".mca"
+#define REGION_LEGACY_EXTENSION ".mcr"
+
+enum REGION_MODE
+{
+    REGION_OFF,
+    REGION_COMPACT,
+    REGION_RECOMPRESS,
+};
+
+//// STRUCTS ////
+
+// A chunk is kept as the compressed bytes it was read with, unless a tag
+// replaces it or it is marked for recompression
+typedef struct Region_chunk_s
+{
+    uint32_t timestamp;
+    uint8_t compression;
+    const uint8_t *data;
+    size_t length;
+
+    Named_tag_t *tag;
+    uint8_t recompress;
+} Region_chunk_t;
+
+typedef struct Region_s
+{
+    char *path;
+    Input_t input;
+    Region_chunk_t chunks[REGION_CHUNKS];
+} Region_t;
+
+//// DECLARATIONS ////
+
+uint8_t is_region_path(const char *path);
+int region_open(Region_t *, const char *path);
+uint8_t region_has_chunk(const Region_t *, size_t index);
+Named_tag_t *region_read_chunk(const Region_t *, size_t index);
+Named_tag_t *region_read_chunk_only(const Region_t *, size_t index,
+                                    const char *const *paths);
+void region_set_chunk(Region_t *, size_t index, Named_tag_t *tag);
+int region_write(Region_t *, FILE *stream, int threads);
+void region_close(Region_t *);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ast.h>
+
+//// MACROS ////
+
+#define SNAPSHOT_EXTENSION ".nbts"
+#define SNAPSHOT_MAGIC     "NBTS"
+#define SNAPSHOT_VERSION   1
+
+// Written in native order, so it reads back differently on a machine of
+// the other byte order
+#define SNAPSHOT_ORDER 0x0102
+
+#define SNAPSHOT_ALIGN     8
+#define SNAPSHOT_MASK      (SNAPSHOT_ALIGN - 1)
+#define SNAPSHOT_PREALLOC  0x10000
+#define SNAPSHOT_NAMES     0x100
+#define SNAPSHOT_NONE      UINT32_MAX
+
+//// STRUCTS ////
+
+// A tag in place. Numbers are held in the record itself, and anything else
+// is at an offset from the start of the snapshot: string bytes with a zero
+// after them, native arrays for arrays and lists of numbers, records for
+// lists of anything else and members for compounds.
+typedef struct Snapshot_tag_s
+{
+    uint8_t type;
+    uint8_t list_type;
+    uint16_t reserved;
+    uint32_t length;
+    union
+    {
+        int64_t integer;
+        double real;
+        uint64_t offset;
+    } load;
+} Snapshot_tag_t;
+
+// Names are indices into the snapshot's table, where each name is only
+// stored once
+typedef struct Snapshot_member_s
+{
+    uint32_t name;
+    uint32_t reserved;
+    Snapshot_tag_t tag;
+} Snapshot_member_t;
+
+typedef struct Snapshot_name_s
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+} Snapshot_name_t;
+
+// Everything is aligned to 8 bytes and size is a multiple of 8, so
+// snapshots can follow each other in a file like roots do
+typedef struct Snapshot_header_s
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t order;
+    uint64_t size;
+    uint64_t names;
+    uint32_t names_length;
+    uint32_t reserved;
+    Snapshot_member_t root;
+} Snapshot_header_t;
+
+typedef struct Snapshot_s
+{
+    const uint8_t *data;
+    size_t length;
+    const Snapshot_header_t *header;
+} Snapshot_t;
+
+typedef struct Snapshot_frame_s
+{
+    uint8_t type;
+    Tag_string_t *name;
+    Builder_t members;
+    Tag_list_t *list;
+    uint64_t records;
+    uint32_t length;
+    uint32_t next;
+} Snapshot_frame_t;
+
+//// DECLARATIONS ////
+
+uint8_t snapshot_is(const uint8_t *data, size_t length);
+int snapshot_serialise(const Named_tag_t *, const uint8_t **data,
+                       size_t *length);
+void snapshot_end();
+
+int snapshot_open(Snapshot_t *, const uint8_t *data, size_t length);
+const Snapshot_tag_t *snapshot_get(const Snapshot_t *,
+                                   const Snapshot_tag_t *compound,
+                                   const char *name, size_t length);
+int snapshot_element(const Snapshot_t *, const Snapshot_tag_t *list,
+                     uint32_t index, Snapshot_tag_t *element);
+const void *snapshot_payload(const Snapshot_t *, const Snapshot_tag_t *);
+const char *snapshot_name(const Snapshot_t *, uint32_t name,
+                          uint32_t *length);
+
+Tag_t *snapshot_tree(const Snapshot_t *, const Snapshot_tag_t *);
+Named_tag_t *snapshot_decode(const Snapshot_t *);
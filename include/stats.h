@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <ast.h>
+
+//// MACROS ////
+
+#define TAG_TYPES 13
+
+enum STATS_PHASE
+{
+    PHASE_INFLATE,
+    PHASE_DECODE,
+    PHASE_PARSE,
+    PHASE_PRINT,
+    PHASE_SERIALISE,
+    PHASE_DEFLATE,
+    PHASE_COUNT,
+};
+
+enum STATS_FORMAT
+{
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON,
+};
+
+//// STRUCTS ////
+
+typedef struct Stats_clock_s
+{
+    double wall;
+    double cpu;
+} Stats_clock_t;
+
+typedef struct Stats_s
+{
+    Stats_clock_t phases[PHASE_COUNT];
+    size_t phase_bytes[PHASE_COUNT];
+    uint8_t ran[PHASE_COUNT];
+
+    size_t files;
+    size_t bytes_in;
+    size_t bytes_out;
+    size_t tags[TAG_TYPES];
+    size_t max_depth;
+} Stats_t;
+
+//// DECLARATIONS ////
+
+void stats_init(Stats_t *);
+Stats_clock_t stats_start(const Stats_t *);
+void stats_stop(Stats_t *, int phase, Stats_clock_t start, size_t bytes);
+void stats_count_tags(Stats_t *, const Named_tag_t *root);
+FILE *stats_stream(FILE *stream, size_t *count);
+void stats_merge(Stats_t *into, const Stats_t *from);
+void stats_print(const Stats_t *, int format, double elapsed, FILE *stream);
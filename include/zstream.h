@@ -0,0 +1,10 @@
+#pragma once
+
+#include <limits.h>
+#include <zlib.h>
+
+//// MACROS ////
+
+// zlib counts its input and output in uInt, so larger sizes are fed to it a
+// UINT_MAX at a time
+#define ZLIB_AVAIL(n) ((n) > UINT_MAX ? UINT_MAX : (uInt) (n))
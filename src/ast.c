@@ -1,10 +1,21 @@
 #include <ast.h>
 #include <print.h>
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+//// VARIABLES ////
+
+static _Thread_local void **scratch = NULL;
+static _Thread_local size_t scratch_length = 0;
+static _Thread_local size_t scratch_capacity = 0;
+
+static _Thread_local Walk_frame_t *walk = NULL;
+static _Thread_local size_t walk_length = 0;
+static _Thread_local size_t walk_capacity = 0;
+
 void (*free_functions[])(Tag_t *) = {
     free_tag_end,        free_tag_byte,  free_tag_short,    free_tag_int,
     free_tag_long,       free_tag_float, free_tag_double,   free_tag_byte_array,
@@ -12,21 +23,28 @@ void (*free_functions[])(Tag_t *) = {
     free_tag_long_array,
 };
 
+//// DECLARATIONS ////
+
+static void free_tree(Tag_t *root, uint8_t type);
+
+//// DEFINITIONS ////
+
 Tag_t *new_end()
 {
-    Tag_t *new = (Tag_t *) malloc(sizeof(Tag_t));
+    Tag_t *new = (Tag_t *) ast_malloc(TAG_End, 1, sizeof(Tag_t));
     new->type = TAG_End;
     return new;
 }
 
 void free_tag_end(Tag_t *ptr)
 {
-    free(ptr);
+    ast_free(ptr);
 }
 
 Tag_byte_t *new_byte(int8_t load)
 {
-    Tag_byte_t *new = (Tag_byte_t *) malloc(sizeof(Tag_byte_t));
+    Tag_byte_t *new =
+        (Tag_byte_t *) ast_malloc(TAG_Byte, 1, sizeof(Tag_byte_t));
     new->load = load;
     new->type = TAG_Byte;
     return new;
@@ -35,12 +53,13 @@ Tag_byte_t *new_byte(int8_t load)
 void free_tag_byte(Tag_t *ptr)
 {
     Tag_byte_t *tag = (Tag_byte_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_short_t *new_short(int16_t load)
 {
-    Tag_short_t *new = (Tag_short_t *) malloc(sizeof(Tag_short_t));
+    Tag_short_t *new =
+        (Tag_short_t *) ast_malloc(TAG_Short, 1, sizeof(Tag_short_t));
     new->load = load;
     new->type = TAG_Short;
     return new;
@@ -49,12 +68,12 @@ Tag_short_t *new_short(int16_t load)
 void free_tag_short(Tag_t *ptr)
 {
     Tag_short_t *tag = (Tag_short_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_int_t *new_int(int32_t load)
 {
-    Tag_int_t *new = (Tag_int_t *) malloc(sizeof(Tag_int_t));
+    Tag_int_t *new = (Tag_int_t *) ast_malloc(TAG_Int, 1, sizeof(Tag_int_t));
     new->load = load;
     new->type = TAG_Int;
     return new;
@@ -63,12 +82,13 @@ Tag_int_t *new_int(int32_t load)
 void free_tag_int(Tag_t *ptr)
 {
     Tag_int_t *tag = (Tag_int_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_long_t *new_long(int64_t load)
 {
-    Tag_long_t *new = (Tag_long_t *) malloc(sizeof(Tag_long_t));
+    Tag_long_t *new =
+        (Tag_long_t *) ast_malloc(TAG_Long, 1, sizeof(Tag_long_t));
     new->load = load;
     new->type = TAG_Long;
     return new;
@@ -77,12 +97,13 @@ Tag_long_t *new_long(int64_t load)
 void free_tag_long(Tag_t *ptr)
 {
     Tag_long_t *tag = (Tag_long_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_float_t *new_float(float load)
 {
-    Tag_float_t *new = (Tag_float_t *) malloc(sizeof(Tag_float_t));
+    Tag_float_t *new =
+        (Tag_float_t *) ast_malloc(TAG_Float, 1, sizeof(Tag_float_t));
     new->load = load;
     new->type = TAG_Float;
     return new;
@@ -91,12 +112,13 @@ Tag_float_t *new_float(float load)
 void free_tag_float(Tag_t *ptr)
 {
     Tag_float_t *tag = (Tag_float_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_double_t *new_double(double load)
 {
-    Tag_double_t *new = (Tag_double_t *) malloc(sizeof(Tag_double_t));
+    Tag_double_t *new =
+        (Tag_double_t *) ast_malloc(TAG_Double, 1, sizeof(Tag_double_t));
     new->load = load;
     new->type = TAG_Double;
     return new;
@@ -105,15 +127,16 @@ Tag_double_t *new_double(double load)
 void free_tag_double(Tag_t *ptr)
 {
     Tag_double_t *tag = (Tag_double_t *) ptr;
-    free(tag);
+    ast_free(tag);
 }
 
 Tag_byte_array_t *new_byte_array(int32_t length)
 {
     Tag_byte_array_t *new =
-        (Tag_byte_array_t *) malloc(sizeof(Tag_byte_array_t));
+        (Tag_byte_array_t *) ast_malloc(TAG_Byte_Array, 1,
+                                        sizeof(Tag_byte_array_t));
     new->length = length;
-    new->load = (int8_t *) malloc(length);
+    new->load = (int8_t *) ast_malloc(TAG_Byte_Array, 0, length);
     new->type = TAG_Byte_Array;
     return new;
 }
@@ -121,15 +144,16 @@ Tag_byte_array_t *new_byte_array(int32_t length)
 void free_tag_byte_array(Tag_t *ptr)
 {
     Tag_byte_array_t *tag = (Tag_byte_array_t *) ptr;
-    free(tag->load);
-    free(tag);
+    ast_free(tag->load);
+    ast_free(tag);
 }
 
-Tag_string_t *new_string(int16_t length)
+Tag_string_t *new_string(uint16_t length)
 {
-    Tag_string_t *new = (Tag_string_t *) malloc(sizeof(Tag_string_t));
+    Tag_string_t *new =
+        (Tag_string_t *) ast_malloc(TAG_String, 1, sizeof(Tag_string_t));
     new->length = length;
-    new->load = (int8_t *) malloc(length + 1);
+    new->load = (int8_t *) ast_malloc(TAG_String, 0, length + 1);
     new->load[length] = 0x00;
     new->type = TAG_String;
     return new;
@@ -138,50 +162,48 @@ Tag_string_t *new_string(int16_t length)
 void free_tag_string(Tag_t *ptr)
 {
     Tag_string_t *tag = (Tag_string_t *) ptr;
-    free(tag->load);
-    free(tag);
+    ast_free(tag->load);
+    ast_free(tag);
 }
 
 Tag_list_t *new_list(int8_t type, int32_t length)
 {
-    Tag_list_t *new = (Tag_list_t *) malloc(sizeof(Tag_list_t));
+    Tag_list_t *new =
+        (Tag_list_t *) ast_malloc(TAG_List, 1, sizeof(Tag_list_t));
     new->list_type = type;
     new->length = length;
-    new->load = (Tag_t **) malloc(length * sizeof(Tag_t *));
+    new->load = (Tag_t **) ast_malloc(TAG_List, 0, length * sizeof(Tag_t *));
     new->type = TAG_List;
     return new;
 }
 
 void free_tag_list(Tag_t *ptr)
 {
-    Tag_list_t *tag = (Tag_list_t *) ptr;
-    for (int i = 0; i < tag->length; i++)
-        free_functions[tag->list_type](tag->load[i]);
-    free(tag->load);
-    free(tag);
+    free_tree(ptr, TAG_List);
 }
 
-Tag_compound_t *new_compound(Compound_node_t *list)
+Tag_compound_t *new_compound(Builder_t *builder)
 {
-    Tag_compound_t *new = (Tag_compound_t *) malloc(sizeof(Tag_compound_t));
-    new->load = finalise_compound_list(list);
+    Tag_compound_t *new =
+        (Tag_compound_t *) ast_malloc(TAG_Compound, 1, sizeof(Tag_compound_t));
+    new->load = finalise_compound_builder(builder);
     new->type = TAG_Compound;
     return new;
 }
 
 void free_tag_compound(Tag_t *ptr)
 {
-    Tag_compound_t *tag = (Tag_compound_t *) ptr;
-    for (int i = 0; tag->load[i]; i++) free_named_tag(tag->load[i]);
-    free(tag->load);
-    free(tag);
+    free_tree(ptr, TAG_Compound);
 }
 
 Tag_int_array_t *new_int_array(int32_t length)
 {
-    Tag_int_array_t *new = (Tag_int_array_t *) malloc(sizeof(Tag_int_array_t));
+    Tag_int_array_t *new =
+        (Tag_int_array_t *) ast_malloc(TAG_Int_Array, 1,
+                                       sizeof(Tag_int_array_t));
     new->length = length;
-    new->load = (int32_t *) malloc(length * sizeof(int32_t));
+    new->load = (int32_t *) ast_malloc(TAG_Int_Array, 0,
+                                       length * sizeof(int32_t));
     new->type = TAG_Int_Array;
     return new;
 }
@@ -189,16 +211,18 @@ Tag_int_array_t *new_int_array(int32_t length)
 void free_tag_int_array(Tag_t *ptr)
 {
     Tag_int_array_t *tag = (Tag_int_array_t *) ptr;
-    free(tag->load);
-    free(tag);
+    ast_free(tag->load);
+    ast_free(tag);
 }
 
 Tag_long_array_t *new_long_array(int32_t length)
 {
     Tag_long_array_t *new =
-        (Tag_long_array_t *) malloc(sizeof(Tag_long_array_t));
+        (Tag_long_array_t *) ast_malloc(TAG_Long_Array, 1,
+                                        sizeof(Tag_long_array_t));
     new->length = length;
-    new->load = (int64_t *) malloc(length * sizeof(int64_t));
+    new->load = (int64_t *) ast_malloc(TAG_Long_Array, 0,
+                                       length * sizeof(int64_t));
     new->type = TAG_Long_Array;
     return new;
 }
@@ -206,13 +230,14 @@ Tag_long_array_t *new_long_array(int32_t length)
 void free_tag_long_array(Tag_t *ptr)
 {
     Tag_long_array_t *tag = (Tag_long_array_t *) ptr;
-    free(tag->load);
-    free(tag);
+    ast_free(tag->load);
+    ast_free(tag);
 }
 
 Named_tag_t *new_named_tag(int8_t type, Tag_string_t *name, Tag_t *tag)
 {
-    Named_tag_t *new = (Named_tag_t *) malloc(sizeof(Named_tag_t));
+    Named_tag_t *new =
+        (Named_tag_t *) ast_malloc(ALLOC_NAMED, 1, sizeof(Named_tag_t));
     new->type = type;
     new->name = name;
     new->tag = tag;
@@ -223,89 +248,282 @@ void free_named_tag(Named_tag_t *tag)
 {
     free_tag_string((Tag_t *) tag->name);
     free_functions[tag->type]((Tag_t *) tag->tag);
-    free(tag);
+    ast_free(tag);
 }
 
 void free_nbt_tag(Named_tag_t *tag)
 {
     free_tag_string((Tag_t *) tag->name);
-    free_tag_compound((Tag_t *) tag->tag);
-    free(tag);
+    free_functions[tag->type](tag->tag);
+    ast_free(tag);
 }
 
-inline Compound_node_t *new_compound_list()
+Builder_t new_builder()
 {
-    return NULL;
+    Builder_t builder = {scratch_length};
+    return builder;
 }
 
-Compound_node_t *add_compound_node(Compound_node_t *list, Named_tag_t *tag)
+void builder_add(Builder_t *builder, void *tag)
 {
-    Compound_node_t *new = (Compound_node_t *) malloc(sizeof(Compound_node_t));
-    new->tag = tag;
-    new->previous = list;
-    return new;
+    if (scratch_length == scratch_capacity) {
+        scratch_capacity =
+            scratch_capacity ? scratch_capacity * 2 : BUILDER_PREALLOC;
+        if (scratch)
+            scratch = (void **) ast_realloc(
+                scratch, scratch_capacity * sizeof(void *));
+        else
+            scratch = (void **) ast_malloc(
+                ALLOC_BUILDER, 1, scratch_capacity * sizeof(void *));
+    }
+    scratch[scratch_length++] = tag;
 }
 
-Named_tag_t **finalise_compound_list(Compound_node_t *list)
+size_t builder_length(const Builder_t *builder)
 {
-    Compound_node_t *ptr;
-    int i, list_size = 1;
+    return scratch_length - builder->start;
+}
 
-    for (ptr = list; ptr; ptr = ptr->previous) list_size++;
+// Finalising copies the members out and pops them off the scratch stack
+Named_tag_t **finalise_compound_builder(Builder_t *builder)
+{
+    size_t length = builder ? builder_length(builder) : 0;
     Named_tag_t **array =
-        (Named_tag_t **) malloc(list_size * sizeof(Named_tag_t *));
-
-    ptr = list;
-    array[list_size - 1] = NULL;
-    i = list_size - 2;
-
-    while (ptr) {
-        Compound_node_t *ref = ptr;
-        array[i] = (Named_tag_t *) ptr->tag;
-        ptr = ptr->previous;
-        free(ref);
-        i--;
+        (Named_tag_t **) ast_malloc(TAG_Compound, 0,
+                                    (length + 1) * sizeof(Named_tag_t *));
+
+    if (length) {
+        memcpy(array, scratch + builder->start, length * sizeof(void *));
+        scratch_length = builder->start;
     }
+    array[length] = NULL;
     return array;
 }
 
-inline List_node_t *new_nodes_list()
+Tag_list_t *finalise_list_builder(int8_t type, Builder_t *builder)
 {
+    size_t length = builder ? builder_length(builder) : 0;
+    Tag_list_t *tag = new_list(type, length);
+
+    if (length) {
+        memcpy(tag->load, scratch + builder->start, length * sizeof(void *));
+        scratch_length = builder->start;
+    }
+    return tag;
+}
+
+// Returns the member with the given name if it has the given type, so
+// callers can look paths up without checking every step themselves
+Tag_t *compound_get(const Tag_t *compound, const char *name, uint8_t type)
+{
+    if (!compound || compound->type != TAG_Compound)
+        return NULL;
+
+    size_t length = strlen(name);
+    Named_tag_t **members = ((const Tag_compound_t *) compound)->load;
+    for (size_t i = 0; members[i]; i++) {
+        Tag_string_t *key = members[i]->name;
+        if ((size_t) key->length == length &&
+            !memcmp(key->load, name, length))
+        {
+            return members[i]->type == type ? members[i]->tag : NULL;
+        }
+    }
     return NULL;
 }
 
-List_node_t *add_list_node(List_node_t *list, Tag_t *tag)
+Walk_frame_t *walk_push(uint8_t type, Tag_t *tag)
 {
-    List_node_t *new = (List_node_t *) malloc(sizeof(List_node_t));
-    new->tag = tag;
-    new->previous = list;
-    return new;
+    if (walk_length == walk_capacity) {
+        walk_capacity = walk_capacity ? walk_capacity * 2 : WALK_PREALLOC;
+        walk = (Walk_frame_t *) realloc(walk,
+                                        walk_capacity * sizeof(Walk_frame_t));
+    }
+
+    Walk_frame_t *frame = walk + walk_length++;
+    frame->type = type;
+    frame->tag = tag;
+    frame->index = 0;
+    return frame;
 }
 
-Tag_list_t *finalise_nodes_list(int8_t type, List_node_t *list)
+Walk_frame_t *walk_top()
 {
-    List_node_t *ptr;
-    int i, list_size = 0;
-    for (ptr = list; ptr; ptr = ptr->previous) {
-        list_size++;
+    return walk + walk_length - 1;
+}
+
+void walk_pop()
+{
+    walk_length--;
+}
+
+size_t walk_depth()
+{
+    return walk_length;
+}
+
+void ast_end()
+{
+    ast_free(scratch);
+    scratch = NULL;
+    scratch_length = scratch_capacity = 0;
+
+    free(walk);
+    walk = NULL;
+    walk_length = walk_capacity = 0;
+}
+
+// Containers are freed after their members, walking down with an explicit
+// stack instead of recursing
+static void free_tree(Tag_t *root, uint8_t type)
+{
+    size_t base = walk_depth();
+    walk_push(type, root);
+
+    while (walk_depth() > base) {
+        Walk_frame_t *frame = walk_top();
+        Tag_t *child;
+
+        if (frame->type == TAG_Compound) {
+            Tag_compound_t *tag = (Tag_compound_t *) frame->tag;
+            Named_tag_t *member = tag->load[frame->index++];
+            if (!member) {
+                ast_free(tag->load);
+                ast_free(tag);
+                walk_pop();
+                continue;
+            }
+            free_tag_string((Tag_t *) member->name);
+            child = member->tag;
+            type = member->type;
+            ast_free(member);
+        }
+        else {
+            Tag_list_t *tag = (Tag_list_t *) frame->tag;
+            if (frame->index == tag->length) {
+                ast_free(tag->load);
+                ast_free(tag);
+                walk_pop();
+                continue;
+            }
+            child = tag->load[frame->index++];
+            type = tag->list_type;
+        }
+
+        switch (type) {
+        case TAG_Compound:
+        case TAG_List:       walk_push(type, child); break;
+        case TAG_Byte_Array: free_tag_byte_array(child); break;
+        case TAG_String:     free_tag_string(child); break;
+        case TAG_Int_Array:  free_tag_int_array(child); break;
+        case TAG_Long_Array: free_tag_long_array(child); break;
+        default:             ast_free(child);
+        }
     }
-    Tag_t **array = (Tag_t **) malloc(list_size * sizeof(Tag_t *));
+}
+
+#ifdef AST_ACCOUNTING
+
+// Every allocation carries its size and kind in front of it, so frees and
+// reallocations can be charged without the callers keeping track
+typedef union Alloc_header_s
+{
+    struct
+    {
+        size_t size;
+        uint8_t kind;
+        uint8_t object;
+    };
+    max_align_t align;
+} Alloc_header_t;
+
+static atomic_size_t live_bytes[ALLOC_KINDS];
+static atomic_size_t live_objects[ALLOC_KINDS];
+static atomic_size_t peak_bytes[ALLOC_KINDS];
+static atomic_size_t total_bytes[ALLOC_KINDS];
+static atomic_size_t total_objects[ALLOC_KINDS];
+static atomic_size_t live_total;
+static atomic_size_t peak_total;
+
+static void raise_peak(atomic_size_t *peak, size_t value)
+{
+    size_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(
+               peak, &seen, value, memory_order_relaxed,
+               memory_order_relaxed))
+        ;
+}
+
+static void charge(uint8_t kind, size_t size)
+{
+    size_t bytes = atomic_fetch_add_explicit(live_bytes + kind, size,
+                                             memory_order_relaxed);
+    size_t total = atomic_fetch_add_explicit(&live_total, size,
+                                             memory_order_relaxed);
+    atomic_fetch_add_explicit(total_bytes + kind, size, memory_order_relaxed);
+    raise_peak(peak_bytes + kind, bytes + size);
+    raise_peak(&peak_total, total + size);
+}
 
-    ptr = list;
-    i = list_size - 1;
+static void refund(uint8_t kind, size_t size)
+{
+    atomic_fetch_sub_explicit(live_bytes + kind, size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&live_total, size, memory_order_relaxed);
+}
 
-    while (ptr) {
-        List_node_t *ref = ptr;
-        array[i] = (Tag_t *) ptr->tag;
-        ptr = ptr->previous;
-        free(ref);
-        i--;
+void *ast_malloc(uint8_t kind, uint8_t object, size_t size)
+{
+    Alloc_header_t *header = malloc(sizeof(Alloc_header_t) + size);
+
+    header->size = size;
+    header->kind = kind;
+    header->object = object;
+    charge(kind, size);
+    if (object) {
+        atomic_fetch_add_explicit(live_objects + kind, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(total_objects + kind, 1,
+                                  memory_order_relaxed);
     }
+    return header + 1;
+}
 
-    Tag_list_t *tag = (Tag_list_t *) malloc(sizeof(Tag_list_t));
-    tag->list_type = type;
-    tag->length = list_size;
-    tag->load = array;
-    tag->type = TAG_List;
-    return tag;
+void *ast_realloc(void *ptr, size_t size)
+{
+    Alloc_header_t *header = (Alloc_header_t *) ptr - 1;
+    uint8_t kind = header->kind;
+
+    refund(kind, header->size);
+    header = realloc(header, sizeof(Alloc_header_t) + size);
+    header->size = size;
+    charge(kind, size);
+    return header + 1;
 }
+
+void ast_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    Alloc_header_t *header = (Alloc_header_t *) ptr - 1;
+    refund(header->kind, header->size);
+    if (header->object)
+        atomic_fetch_sub_explicit(live_objects + header->kind, 1,
+                                  memory_order_relaxed);
+    free(header);
+}
+
+size_t ast_accounting(Alloc_counter_t counters[ALLOC_KINDS])
+{
+    for (int i = 0; i < ALLOC_KINDS; i++) {
+        counters[i].bytes = atomic_load(live_bytes + i);
+        counters[i].objects = atomic_load(live_objects + i);
+        counters[i].peak_bytes = atomic_load(peak_bytes + i);
+        counters[i].total_bytes = atomic_load(total_bytes + i);
+        counters[i].total_objects = atomic_load(total_objects + i);
+    }
+    return atomic_load(&peak_total);
+}
+
+#endif
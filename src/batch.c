@@ -0,0 +1,850 @@
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <ftw.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ast.h>
+#include <batch.h>
+#include <blocks.h>
+#include <census.h>
+#include <compress.h>
+#include <decompress.h>
+#include <index.h>
+#include <input.h>
+#include <parse.h>
+#include <pool.h>
+#include <print.h>
+#include <region.h>
+#include <snapshot.h>
+#include <stats.h>
+
+//// MACROS ////
+
+#define WALK_FDS 32
+
+//// VARIABLES ////
+
+// nftw() takes no context, so directory walks go through these
+static Batch_t *walk_batch;
+static size_t walk_root_length;
+
+//// DECLARATIONS ////
+
+static int write_tag(Named_tag_t *tag, FILE *stream,
+                     const Convert_options_t *options);
+static int convert_region(const char *path, FILE *stream,
+                          const Convert_options_t *options);
+static int compact_in_place(const char *path,
+                            const Convert_options_t *options);
+static int census_file(const char *path, const Convert_options_t *options,
+                       size_t *chunks);
+static int get_from_file(const char *path, FILE *stream,
+                         const Convert_options_t *options);
+static int convert_snapshots(const Input_t *input, FILE *stream,
+                             const Convert_options_t *options);
+static int get_from_snapshots(const Input_t *input,
+                              const Index_path_t *lookup, FILE *stream,
+                              const Convert_options_t *options,
+                              size_t *found);
+
+static void add_job(Batch_t *batch, const char *path, const char *name);
+static int walk_entry(const char *path, const struct stat *st, int flag,
+                      struct FTW *ftw);
+
+static void batch_job(void *ctx, size_t index);
+static void batch_done(void *ctx);
+
+static char *output_path(const Batch_t *batch, const Batch_job_t *job);
+static int make_parents(char *path);
+
+//// DEFINITIONS ////
+
+int convert_file(const char *path, FILE *stream,
+                 const Convert_options_t *options)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    Input_t input;
+    Named_tag_t *tag;
+    int status = 0;
+
+    if (options->get)
+        return get_from_file(path, stream, options);
+    if (options->region || (!options->parse && is_region_path(path)))
+        return convert_region(path, stream, options);
+
+    if (input_open(&input, path))
+        return -1;
+
+    if (stats) {
+        stats->files++;
+        stats->bytes_in += input.length;
+    }
+
+    if (!options->parse && snapshot_is(input.data, input.length)) {
+        status = convert_snapshots(&input, stream, options);
+        input_close(&input);
+        return status;
+    }
+
+    if (options->parse) {
+        start = stats_start(stats);
+        tag = parse_nbt_tag((const char *) input.data, input.length);
+        stats_stop(stats, PHASE_PARSE, start, input.length);
+        input_close(&input);
+
+        if (!tag)
+            return -1;
+        status = write_tag(tag, stream, options);
+        free_nbt_tag(tag);
+        return status;
+    }
+
+    const uint8_t *data = input.data;
+    uint8_t *inflated = NULL;
+    size_t length = input.length;
+    int threads = 1;
+
+    // Small inputs are inflated up front. Large ones are inflated as they
+    // decode, on a second thread if there is one, and that time only shows
+    // up as decoding.
+    if (nbt_is_compressed(data, length) && length < STREAM_MIN_SIZE) {
+        start = stats_start(stats);
+        status = nbt_inflate(data, length, &inflated, &length);
+        stats_stop(stats, PHASE_INFLATE, start, length);
+        data = inflated;
+    }
+    else
+        threads = options->threads;
+
+    // Several roots may follow each other, and each is written as it comes
+    Nbt_stream_t *roots = status ? NULL : nbt_stream_open(data, length,
+                                                          threads);
+    uint8_t failed = !roots;
+    while (roots) {
+        size_t offset = nbt_stream_offset(roots);
+
+        start = stats_start(stats);
+        tag = nbt_stream_next(roots);
+        stats_stop(stats, PHASE_DECODE, start,
+                   nbt_stream_offset(roots) - offset);
+
+        if (!tag) {
+            failed = get_decode_error() != NULL;
+            break;
+        }
+        if (write_tag(tag, stream, options))
+            status = -1;
+        free_nbt_tag(tag);
+    }
+
+    if (failed) {
+        flockfile(stderr);
+        if (path)
+            fprintf(stderr, _ERR "%s:\n" _CLEAR, path);
+        print_decode_error(get_decode_error());
+        funlockfile(stderr);
+        status = -1;
+    }
+
+    nbt_stream_close(roots);
+    free(inflated);
+    input_close(&input);
+    return status;
+}
+
+// Region files are either rewritten, or have each chunk converted as a root
+static int convert_region(const char *path, FILE *stream,
+                          const Convert_options_t *options)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    Region_t region;
+    int status = 0;
+
+    if (region_open(&region, path))
+        return -1;
+
+    if (stats) {
+        stats->files++;
+        stats->bytes_in += region.input.length;
+    }
+
+    if (options->region) {
+        for (size_t i = 0; i < REGION_CHUNKS; i++)
+            region.chunks[i].recompress = options->region == REGION_RECOMPRESS;
+
+        FILE *out = stream;
+        if (stats && !(out = stats_stream(stream, &stats->bytes_out)))
+            out = stream;
+
+        start = stats_start(stats);
+        status = region_write(&region, out, options->threads);
+        stats_stop(stats, PHASE_DEFLATE, start, region.input.length);
+
+        if (out != stream && fclose(out))
+            status = -1;
+        region_close(&region);
+        return status;
+    }
+
+    for (size_t i = 0; i < REGION_CHUNKS; i++) {
+        if (!region_has_chunk(&region, i))
+            continue;
+
+        start = stats_start(stats);
+        Named_tag_t *tag = region_read_chunk(&region, i);
+        stats_stop(stats, PHASE_DECODE, start, region.chunks[i].length);
+
+        if (!tag || write_tag(tag, stream, options))
+            status = -1;
+        if (tag)
+            free_nbt_tag(tag);
+    }
+
+    region_close(&region);
+    return status;
+}
+
+// The new file only replaces the old one once it has been written in full
+static int compact_in_place(const char *path,
+                            const Convert_options_t *options)
+{
+    size_t length = strlen(path) + strlen(TEMP_EXTENSION) + 1;
+    char *temp = (char *) malloc(length);
+    snprintf(temp, length, "%s%s", path, TEMP_EXTENSION);
+
+    int status = -1;
+    FILE *stream = fopen(temp, "wb");
+    if (!stream)
+        fprintf(stderr, _ERR "Error! Can't create \"%s\": %s.\n" _CLEAR,
+                temp, strerror(errno));
+    else {
+        // The new file takes the place of the old one, permissions and all
+        struct stat st;
+        if (!stat(path, &st))
+            fchmod(fileno(stream), st.st_mode & 07777);
+
+        status = convert_file(path, stream, options);
+        if (fclose(stream))
+            status = -1;
+        if (!status && rename(temp, path)) {
+            fprintf(stderr, _ERR "Error! Can't replace \"%s\": %s.\n" _CLEAR,
+                    path, strerror(errno));
+            status = -1;
+        }
+        if (status)
+            unlink(temp);
+    }
+
+    free(temp);
+    return status;
+}
+
+// Only what a census needs is decoded from each chunk, and a file that
+// isn't a region file counts as a single chunk
+static int census_file(const char *path, const Convert_options_t *options,
+                       size_t *chunks)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    Region_t region;
+    Named_tag_t *tag;
+    int status = 0;
+
+    *chunks = 0;
+    if (!is_region_path(path)) {
+        Input_t input;
+        if (input_open(&input, path))
+            return -1;
+        if (stats) {
+            stats->files++;
+            stats->bytes_in += input.length;
+        }
+
+        start = stats_start(stats);
+        tag = nbt_decompress_only(input.data, input.length, census_paths);
+        stats_stop(stats, PHASE_DECODE, start, input.length);
+
+        if (!tag) {
+            flockfile(stderr);
+            fprintf(stderr, _ERR "%s:\n" _CLEAR, path);
+            print_decode_error(get_decode_error());
+            funlockfile(stderr);
+            status = -1;
+        }
+        else {
+            if (census_count(tag)) {
+                fprintf(stderr,
+                        _ERR "Error! \"%s\" has invalid block states.\n"
+                        _CLEAR, path);
+                status = -1;
+            }
+            free_nbt_tag(tag);
+            *chunks = 1;
+        }
+        input_close(&input);
+        return status;
+    }
+
+    if (region_open(&region, path))
+        return -1;
+    if (stats) {
+        stats->files++;
+        stats->bytes_in += region.input.length;
+    }
+
+    for (size_t i = 0; i < REGION_CHUNKS; i++) {
+        if (!region_has_chunk(&region, i))
+            continue;
+
+        start = stats_start(stats);
+        tag = region_read_chunk_only(&region, i, census_paths);
+        stats_stop(stats, PHASE_DECODE, start, region.chunks[i].length);
+
+        if (!tag) {
+            status = -1;
+            continue;
+        }
+        if (census_count(tag)) {
+            fprintf(stderr,
+                    _ERR "Error! Chunk %zu of \"%s\" has invalid block "
+                         "states.\n" _CLEAR,
+                    i, path);
+            status = -1;
+        }
+        free_nbt_tag(tag);
+        (*chunks)++;
+    }
+
+    region_close(&region);
+    return status;
+}
+
+// Looks the path up through the file's index, which is made first if it
+// is missing or out of date. Every root with something there is written.
+static int get_from_file(const char *path, FILE *stream,
+                         const Convert_options_t *options)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    Index_path_t lookup;
+    Index_t index;
+    Input_t input;
+    size_t found = 0;
+    int status = 0;
+
+    if (is_region_path(path)) {
+        fprintf(stderr, _ERR "Error! \"%s\" is a region file, which --get "
+                "does not read.\n" _CLEAR, path);
+        return -1;
+    }
+    if (index_parse_path(&lookup, options->get))
+        return -1;
+    if (input_open(&input, path)) {
+        index_free_path(&lookup);
+        return -1;
+    }
+    if (stats) {
+        stats->files++;
+        stats->bytes_in += input.length;
+    }
+
+    // Snapshots are read in place, so they need no index
+    uint8_t snapshot = snapshot_is(input.data, input.length);
+    memset(&index, 0, sizeof(Index_t));
+
+    start = stats_start(stats);
+    if (snapshot)
+        status = get_from_snapshots(&input, &lookup, stream, options, &found);
+    else
+        status = index_open(&index, path, &input);
+    for (size_t i = 0; !status && i < index.roots_length; i++) {
+        Named_tag_t *tag;
+        status = index_get(&index, &input, &lookup, i, &tag);
+        if (tag) {
+            found++;
+            if (write_tag(tag, stream, options))
+                status = -1;
+            free_nbt_tag(tag);
+        }
+    }
+    stats_stop(stats, PHASE_DECODE, start, input.length);
+
+    if (status && !snapshot && get_decode_error()) {
+        flockfile(stderr);
+        if (path)
+            fprintf(stderr, _ERR "%s:\n" _CLEAR, path);
+        print_decode_error(get_decode_error());
+        funlockfile(stderr);
+    }
+    else if (!status && !found) {
+        fprintf(stderr, _ERR "Error! Nothing at \"%s\" in \"%s\".\n" _CLEAR,
+                options->get, path ? path : "stdin");
+        status = -1;
+    }
+
+    index_close(&index);
+    input_close(&input);
+    index_free_path(&lookup);
+    return status;
+}
+
+// Snapshots follow each other like roots do, and each is decoded back into
+// a tree to be written out
+static int convert_snapshots(const Input_t *input, FILE *stream,
+                             const Convert_options_t *options)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    Snapshot_t snapshot;
+    size_t offset = 0;
+    int status = 0;
+
+    while (offset < input->length && !status) {
+        if (snapshot_open(&snapshot, input->data + offset,
+                          input->length - offset))
+            return -1;
+
+        start = stats_start(stats);
+        Named_tag_t *tag = snapshot_decode(&snapshot);
+        stats_stop(stats, PHASE_DECODE, start, snapshot.length);
+        if (!tag)
+            return -1;
+
+        status = write_tag(tag, stream, options);
+        free_nbt_tag(tag);
+        offset += snapshot.length;
+    }
+    return status;
+}
+
+// Follows the path through each snapshot's records, decoding only what is
+// at the end of it
+static int get_from_snapshots(const Input_t *input,
+                              const Index_path_t *lookup, FILE *stream,
+                              const Convert_options_t *options,
+                              size_t *found)
+{
+    Snapshot_t snapshot;
+    size_t offset = 0;
+    int status = 0;
+
+    while (offset < input->length && !status) {
+        if (snapshot_open(&snapshot, input->data + offset,
+                          input->length - offset))
+            return -1;
+        offset += snapshot.length;
+
+        const Snapshot_member_t *root = &snapshot.header->root;
+        Snapshot_tag_t tag = root->tag;
+        size_t depth = 0;
+
+        for (; depth < lookup->length; depth++) {
+            const Path_segment_t *segment = lookup->segments + depth;
+            const Snapshot_tag_t *member;
+
+            if (!segment->name) {
+                if (segment->index < 0 ||
+                    snapshot_element(&snapshot, &tag, segment->index, &tag))
+                    break;
+            }
+            else if ((member = snapshot_get(&snapshot, &tag, segment->name,
+                                            segment->length)))
+                tag = *member;
+            else
+                break;
+        }
+        if (depth < lookup->length)
+            continue;
+
+        uint32_t length;
+        const char *name = snapshot_name(&snapshot, root->name, &length);
+        Tag_t *value = name ? snapshot_tree(&snapshot, &tag) : NULL;
+        if (!value)
+            return -1;
+
+        Named_tag_t *result = index_result(lookup, name, length, tag.type,
+                                           value);
+        (*found)++;
+        status = write_tag(result, stream, options);
+        free_nbt_tag(result);
+    }
+    return status;
+}
+
+static int write_tag(Named_tag_t *tag, FILE *stream,
+                     const Convert_options_t *options)
+{
+    Stats_t *stats = options->stats;
+    Stats_clock_t start;
+    int status;
+
+    stats_count_tags(stats, tag);
+
+    // Output is counted on its way to the stream, whatever the stream is
+    FILE *out = stream;
+    if (stats && !(out = stats_stream(stream, &stats->bytes_out)))
+        out = stream;
+
+    if (options->blocks) {
+        size_t printed = stats ? stats->bytes_out : 0;
+
+        start = stats_start(stats);
+        status = blocks_print(tag, options->blocks, out);
+        if (stats) {
+            fflush(out);
+            stats_stop(stats, PHASE_PRINT, start, stats->bytes_out - printed);
+        }
+    }
+    else if (options->snapshot) {
+        const uint8_t *data;
+        size_t length;
+
+        start = stats_start(stats);
+        status = snapshot_serialise(tag, &data, &length);
+        stats_stop(stats, PHASE_SERIALISE, start, length);
+
+        if (!status && fwrite(data, length, 1, out) != 1) {
+            fprintf(stderr, _ERR "Error! Couldn't write output.\n" _CLEAR);
+            status = -1;
+        }
+    }
+    else if (options->compr) {
+        const uint8_t *data;
+        size_t length;
+
+        start = stats_start(stats);
+        status = nbt_serialise(tag, &data, &length);
+        stats_stop(stats, PHASE_SERIALISE, start, length);
+
+        if (!status) {
+            start = stats_start(stats);
+            status = nbt_deflate_parallel(data, length, out,
+                                          options->threads);
+            stats_stop(stats, PHASE_DEFLATE, start, length);
+        }
+        if (colours)
+            fprintf(out, "\n");
+    }
+    else {
+        size_t printed = stats ? stats->bytes_out : 0;
+
+        start = stats_start(stats);
+        status = print_nbt_tag(tag, out);
+        if (colours)
+            fprintf(out, _CLEAR "\n");
+        else
+            fprintf(out, "\n");
+        if (stats) {
+            fflush(out);
+            stats_stop(stats, PHASE_PRINT, start, stats->bytes_out - printed);
+        }
+    }
+
+    if (out != stream && fclose(out))
+        status = -1;
+
+    return status;
+}
+
+void batch_init(Batch_t *batch)
+{
+    batch->jobs = NULL;
+    batch->length = 0;
+    batch->capacity = 0;
+    batch->options.parse = 0;
+    batch->options.compr = 0;
+    batch->options.snapshot = 0;
+    batch->options.region = REGION_OFF;
+    batch->options.blocks = BLOCKS_OFF;
+    batch->options.threads = 1;
+    batch->options.stats = NULL;
+    batch->options.census = NULL;
+    batch->options.get = NULL;
+    batch->output_dir = NULL;
+    batch->threads = 0;
+    atomic_init(&batch->failed, 0);
+    atomic_init(&batch->finished, 0);
+}
+
+int batch_add_path(Batch_t *batch, const char *path)
+{
+    struct stat st;
+
+    if (!stat(path, &st)) {
+        if (!S_ISDIR(st.st_mode)) {
+            const char *name = strrchr(path, '/');
+            add_job(batch, path, name ? name + 1 : path);
+            return 0;
+        }
+
+        // Files found in directories keep their relative paths as names
+        walk_batch = batch;
+        walk_root_length = strlen(path);
+        while (walk_root_length > 1 && path[walk_root_length - 1] == '/')
+            walk_root_length--;
+
+        if (nftw(path, walk_entry, WALK_FDS, FTW_PHYS)) {
+            fprintf(stderr, _ERR "Error! Can't walk \"%s\": %s.\n" _CLEAR,
+                    path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    // Patterns are expanded here so they also work from file lists
+    if (strpbrk(path, "*?[")) {
+        glob_t matches;
+        int status = glob(path, 0, NULL, &matches);
+
+        if (!status) {
+            for (size_t i = 0; i < matches.gl_pathc && !status; i++)
+                status = batch_add_path(batch, matches.gl_pathv[i]);
+            globfree(&matches);
+            return status;
+        }
+        if (status == GLOB_NOMATCH) {
+            fprintf(stderr, _ERR "Error! No files match \"%s\".\n" _CLEAR,
+                    path);
+            return -1;
+        }
+    }
+
+    fprintf(stderr, _ERR "Error! Can't open \"%s\": %s.\n" _CLEAR, path,
+            strerror(errno));
+    return -1;
+}
+
+int batch_add_list(Batch_t *batch, const char *list_path)
+{
+    FILE *list = strcmp(list_path, "-") ? fopen(list_path, "r") : stdin;
+    if (!list) {
+        fprintf(stderr, _ERR "Error! Can't open \"%s\": %s.\n" _CLEAR,
+                list_path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int status = 0;
+
+    while (!status && (length = getline(&line, &capacity, list)) >= 0) {
+        while (length > 0 &&
+               (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = 0x00;
+        }
+        if (length)
+            status = batch_add_path(batch, line);
+    }
+
+    free(line);
+    if (list != stdin)
+        fclose(list);
+    return status;
+}
+
+int batch_run(Batch_t *batch)
+{
+    if (batch->output_dir && mkdir(batch->output_dir, 0777) &&
+        errno != EEXIST)
+    {
+        fprintf(stderr, _ERR "Error! Can't create \"%s\": %s.\n" _CLEAR,
+                batch->output_dir, strerror(errno));
+        return -1;
+    }
+
+    // Threads left over when there are fewer files go to each file's work
+    int threads = pool_threads(batch->threads);
+    if (batch->length && (size_t) threads > batch->length)
+        batch->options.threads = threads / batch->length;
+
+    pool_run(threads, batch->length, batch_job, batch_done, batch);
+
+    size_t failed = atomic_load(&batch->failed);
+    fprintf(stderr, _OK "%s %zu of %zu files.\n" _CLEAR,
+            batch->options.census ? "Scanned" : "Converted",
+            batch->length - failed, batch->length);
+
+    return failed ? -1 : 0;
+}
+
+void batch_free(Batch_t *batch)
+{
+    for (size_t i = 0; i < batch->length; i++) {
+        free(batch->jobs[i].path);
+        free(batch->jobs[i].name);
+    }
+    free(batch->jobs);
+    batch->jobs = NULL;
+    batch->length = batch->capacity = 0;
+}
+
+static void add_job(Batch_t *batch, const char *path, const char *name)
+{
+    if (batch->length == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : CHUNK;
+        batch->jobs = (Batch_job_t *) realloc(
+            batch->jobs, batch->capacity * sizeof(Batch_job_t));
+    }
+
+    Batch_job_t *job = batch->jobs + batch->length++;
+    job->path = strdup(path);
+    job->name = strdup(name);
+}
+
+static int walk_entry(const char *path, const struct stat *st, int flag,
+                      struct FTW *ftw)
+{
+    // Only region files are picked out of world directories to rewrite or
+    // take a census of
+    if (flag == FTW_F && S_ISREG(st->st_mode) &&
+        ((!walk_batch->options.region && !walk_batch->options.census) ||
+         is_region_path(path)))
+    {
+        const char *name = path + walk_root_length;
+        if (*name == '/') name++;
+        add_job(walk_batch, path, name);
+    }
+    return 0;
+}
+
+static void batch_job(void *ctx, size_t index)
+{
+    Batch_t *batch = (Batch_t *) ctx;
+    Batch_job_t *job = batch->jobs + index;
+    Convert_options_t options = batch->options;
+    Stats_t stats;
+    int status;
+
+    // Each job counts into its own stats, which are merged once it is done
+    if (options.stats) {
+        stats_init(&stats);
+        options.stats = &stats;
+    }
+
+    if (options.census) {
+        size_t chunks;
+        status = census_file(job->path, &options, &chunks);
+
+        // Progress goes out a line per file, in the order they finish
+        size_t finished = atomic_fetch_add(&batch->finished, 1) + 1;
+        fprintf(stderr, "[%zu/%zu] %s: %zu chunks\n", finished,
+                batch->length, job->path, chunks);
+    }
+    else if (options.region && !batch->output_dir)
+        status = compact_in_place(job->path, &options);
+    else if (batch->output_dir) {
+        char *path = output_path(batch, job);
+        FILE *stream = make_parents(path) ? NULL : fopen(path, "wb");
+
+        if (stream) {
+            status = convert_file(job->path, stream, &options);
+            if (fclose(stream))
+                status = -1;
+            if (status)
+                unlink(path);
+        }
+        else {
+            fprintf(stderr, _ERR "Error! Can't create \"%s\": %s.\n" _CLEAR,
+                    path, strerror(errno));
+            status = -1;
+        }
+        free(path);
+    }
+    else {
+        // Each document is rendered in memory and then written with a single
+        // call, which stdio keeps atomic, so outputs never interleave
+        char *buf = NULL;
+        size_t length = 0;
+        FILE *stream = open_memstream(&buf, &length);
+
+        status = convert_file(job->path, stream, &options);
+        fclose(stream);
+        if (!status && length)
+            fwrite(buf, length, 1, stdout);
+        free(buf);
+    }
+
+    if (options.stats)
+        stats_merge(batch->options.stats, &stats);
+
+    if (status) {
+        atomic_fetch_add(&batch->failed, 1);
+        fprintf(stderr, _ERR "Error! Failed to %s \"%s\".\n" _CLEAR,
+                options.census ? "scan" : "convert", job->path);
+    }
+}
+
+static void batch_done(void *ctx)
+{
+    Batch_t *batch = (Batch_t *) ctx;
+
+    if (batch->options.census)
+        census_end(batch->options.census);
+    ast_end();
+    nbt_decompress_end();
+    nbt_compress_end();
+    snapshot_end();
+}
+
+static char *output_path(const Batch_t *batch, const Batch_job_t *job)
+{
+    // Binary output drops the text or snapshot extension so conversions
+    // round-trip
+    size_t name_length = strlen(job->name);
+    size_t text_length = strlen(TEXT_EXTENSION);
+    size_t snapshot_length = strlen(SNAPSHOT_EXTENSION);
+    const char *extension = TEXT_EXTENSION;
+
+    if (batch->options.region)
+        extension = "";
+    else if (batch->options.snapshot)
+        extension = SNAPSHOT_EXTENSION;
+    else if (batch->options.compr) {
+        extension = BINARY_EXTENSION;
+        if (name_length > text_length &&
+            !strcmp(job->name + name_length - text_length, TEXT_EXTENSION))
+        {
+            name_length -= text_length;
+            extension = "";
+        }
+        else if (name_length > snapshot_length &&
+                 !strcmp(job->name + name_length - snapshot_length,
+                         SNAPSHOT_EXTENSION))
+        {
+            name_length -= snapshot_length;
+            extension = "";
+        }
+    }
+
+    size_t length = strlen(batch->output_dir) + name_length +
+                    strlen(extension) + 2;
+    char *path = (char *) malloc(length);
+    snprintf(path, length, "%s/%.*s%s", batch->output_dir, (int) name_length,
+             job->name, extension);
+    return path;
+}
+
+static int make_parents(char *path)
+{
+    for (char *slash = strchr(path + 1, '/'); slash;
+         slash = strchr(slash + 1, '/'))
+    {
+        *slash = 0x00;
+        int status = mkdir(path, 0777);
+        *slash = '/';
+        if (status && errno != EEXIST)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,430 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_PATH
+#endif
+
+#include <ast.h>
+#include <blocks.h>
+#include <print.h>
+
+//// MACROS ////
+
+// Groups of entries a single long can hold at one bit each
+#define UNPACK_GROUPS (64 / UNPACK_STEP)
+
+//// STRUCTS ////
+
+typedef struct Block_count_s
+{
+    uint32_t count;
+    uint16_t index;
+} Block_count_t;
+
+//// DECLARATIONS ////
+
+static void unpack_aligned(const int64_t *data, int bits, uint16_t *out,
+                           size_t from);
+static void unpack_straddling(const int64_t *data, int bits, uint16_t *out,
+                              size_t from);
+#ifdef HAVE_AVX2_PATH
+static uint8_t has_avx2();
+static size_t unpack_aligned_avx2(const int64_t *data, int bits,
+                                  uint16_t *out);
+static size_t unpack_straddling_avx2(const int64_t *data, size_t length,
+                                     int bits, uint16_t *out);
+static void lane_control(const size_t start[UNPACK_STEP], uint8_t *shuffle,
+                         uint32_t *shift);
+#endif
+
+static int print_section(Tag_t *section, int32_t x, int32_t z, int mode,
+                         FILE *stream);
+static char **state_names(Tag_list_t *palette);
+static int compare_counts(const void *a, const void *b);
+
+//// DEFINITIONS ////
+
+// Block states take at least 4 bits an entry, and as many more as the
+// palette needs
+int blocks_bits(size_t palette_length)
+{
+    int bits = BLOCK_MIN_BITS;
+    while ((size_t) 1 << bits < palette_length)
+        bits++;
+    return bits;
+}
+
+// Since 1.16 entries never straddle two longs, and the spare high bits of
+// each long are left empty. Before that they were packed back to back. Which
+// one applies shows in the length, and both agree when 64 is a multiple of
+// the width.
+int blocks_unpack(const int64_t *data, size_t length, int bits,
+                  uint16_t out[SECTION_BLOCKS])
+{
+    if (bits < 1 || bits > BLOCK_MAX_BITS)
+        return -1;
+
+    size_t per_long = 64 / bits;
+    size_t aligned = (SECTION_BLOCKS + per_long - 1) / per_long;
+    size_t straddling = SECTION_BLOCKS * bits / 64;
+    size_t done = 0;
+
+    if (length == aligned) {
+#ifdef HAVE_AVX2_PATH
+        if (has_avx2())
+            done = unpack_aligned_avx2(data, bits, out);
+#endif
+        unpack_aligned(data, bits, out, done);
+        return 0;
+    }
+    if (length == straddling) {
+#ifdef HAVE_AVX2_PATH
+        if (has_avx2())
+            done = unpack_straddling_avx2(data, length, bits, out);
+#endif
+        unpack_straddling(data, bits, out, done);
+        return 0;
+    }
+    return -1;
+}
+
+// Prints a line per section with its blocks by count, or one line per block
+// with its coordinates and state
+int blocks_print(Named_tag_t *chunk, int mode, FILE *stream)
+{
+    Tag_t *position;
+    Tag_list_t *sections = blocks_sections(chunk, &position);
+    int status = 0;
+
+    if (!sections)
+        return 0;
+
+    Tag_int_t *x = (Tag_int_t *) compound_get(position, "xPos", TAG_Int);
+    Tag_int_t *z = (Tag_int_t *) compound_get(position, "zPos", TAG_Int);
+
+    for (int32_t i = 0; i < sections->length; i++) {
+        if (print_section(sections->load[i], x ? x->load : 0,
+                          z ? z->load : 0, mode, stream))
+            status = -1;
+    }
+    return status;
+}
+
+// Finds the list of sections, and the compound holding the chunk's position
+Tag_list_t *blocks_sections(Named_tag_t *chunk, Tag_t **position)
+{
+    Tag_t *root = chunk->tag;
+    Tag_t *level = compound_get(root, "Level", TAG_Compound);
+    Tag_list_t *sections =
+        (Tag_list_t *) compound_get(root, "sections", TAG_List);
+
+    *position = root;
+
+    // Chunks before 1.18 keep everything under Level
+    if (!sections && level) {
+        sections = (Tag_list_t *) compound_get(level, "Sections", TAG_List);
+        *position = level;
+    }
+    if (!sections || sections->list_type != TAG_Compound)
+        return NULL;
+    return sections;
+}
+
+// Unpacks a section's block states into palette indices, which are checked
+// against the palette. Sections without blocks leave the palette NULL.
+int blocks_section(Tag_t *section, Tag_list_t **palette,
+                   uint16_t out[SECTION_BLOCKS])
+{
+    Tag_t *states = compound_get(section, "block_states", TAG_Compound);
+    Tag_list_t *entries;
+    Tag_long_array_t *data;
+
+    if (states) {
+        entries = (Tag_list_t *) compound_get(states, "palette", TAG_List);
+        data = (Tag_long_array_t *) compound_get(states, "data",
+                                                 TAG_Long_Array);
+    }
+    else {
+        entries = (Tag_list_t *) compound_get(section, "Palette", TAG_List);
+        data = (Tag_long_array_t *) compound_get(section, "BlockStates",
+                                                 TAG_Long_Array);
+    }
+
+    *palette = NULL;
+
+    // Sections that only hold light have no blocks
+    if (!entries || !entries->length ||
+        entries->list_type != TAG_Compound)
+        return 0;
+
+    // A single entry palette needs no data, every block is that entry
+    if (!data)
+        memset(out, 0, SECTION_BLOCKS * sizeof(uint16_t));
+    else if (blocks_unpack(data->load, data->length,
+                           blocks_bits(entries->length), out))
+        return -1;
+
+    for (size_t i = 0; i < SECTION_BLOCKS; i++) {
+        if (out[i] >= entries->length)
+            return -1;
+    }
+    *palette = entries;
+    return 0;
+}
+
+static int print_section(Tag_t *section, int32_t x, int32_t z, int mode,
+                         FILE *stream)
+{
+    Tag_byte_t *y = (Tag_byte_t *) compound_get(section, "Y", TAG_Byte);
+    int32_t section_y = y ? y->load : 0;
+
+    uint16_t *blocks = (uint16_t *) malloc(SECTION_BLOCKS * sizeof(uint16_t));
+    Tag_list_t *palette;
+    int status = 0;
+
+    if (blocks_section(section, &palette, blocks)) {
+        fprintf(stderr,
+                _ERR "Error! Section %d of chunk %d, %d has invalid block "
+                     "states.\n" _CLEAR,
+                section_y, x, z);
+        free(blocks);
+        return -1;
+    }
+    if (!palette) {
+        free(blocks);
+        return 0;
+    }
+
+    char **names = state_names(palette);
+
+    if (mode == BLOCKS_HISTOGRAM) {
+        Block_count_t *counts = (Block_count_t *) calloc(
+            palette->length, sizeof(Block_count_t));
+        for (int32_t i = 0; i < palette->length; i++)
+            counts[i].index = i;
+        for (size_t i = 0; i < SECTION_BLOCKS; i++)
+            counts[blocks[i]].count++;
+        qsort(counts, palette->length, sizeof(Block_count_t),
+              compare_counts);
+
+        fprintf(stream, "chunk %d %d section %d:", x, z, section_y);
+        for (int32_t i = 0; i < palette->length && counts[i].count; i++)
+            fprintf(stream, "%s %u %s", i ? "," : "", counts[i].count,
+                    names[counts[i].index]);
+        fprintf(stream, "\n");
+        free(counts);
+    }
+    else {
+        // Blocks are stored in YZX order
+        for (int i = 0; i < SECTION_BLOCKS; i++) {
+            int block_x = i % SECTION_SIDE;
+            int block_z = i / SECTION_SIDE % SECTION_SIDE;
+            int block_y = i / (SECTION_SIDE * SECTION_SIDE);
+            fprintf(stream, "%d %d %d %s\n", x * SECTION_SIDE + block_x,
+                    section_y * SECTION_SIDE + block_y,
+                    z * SECTION_SIDE + block_z, names[blocks[i]]);
+        }
+    }
+
+    for (int32_t i = 0; i < palette->length; i++)
+        free(names[i]);
+    free(names);
+    free(blocks);
+    return status;
+}
+
+// Names a palette entry the way commands do, as name[key=value,...]
+static char **state_names(Tag_list_t *palette)
+{
+    char **names = (char **) malloc(palette->length * sizeof(char *));
+
+    for (int32_t i = 0; i < palette->length; i++) {
+        Tag_t *entry = palette->load[i];
+        Tag_string_t *name =
+            (Tag_string_t *) compound_get(entry, "Name", TAG_String);
+        Tag_t *properties = compound_get(entry, "Properties", TAG_Compound);
+
+        char *text = NULL;
+        size_t length = 0;
+        FILE *stream = open_memstream(&text, &length);
+
+        if (name)
+            fwrite(name->load, 1, name->length, stream);
+        if (properties && ((Tag_compound_t *) properties)->load[0]) {
+            Named_tag_t **members = ((Tag_compound_t *) properties)->load;
+            for (int j = 0; members[j]; j++) {
+                Tag_string_t *value = (Tag_string_t *) members[j]->tag;
+                fputc(j ? ',' : '[', stream);
+                fwrite(members[j]->name->load, 1, members[j]->name->length,
+                       stream);
+                fputc('=', stream);
+                if (members[j]->type == TAG_String)
+                    fwrite(value->load, 1, value->length, stream);
+            }
+            fputc(']', stream);
+        }
+        fclose(stream);
+        names[i] = text;
+    }
+    return names;
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+    const Block_count_t *first = (const Block_count_t *) a;
+    const Block_count_t *second = (const Block_count_t *) b;
+
+    if (first->count != second->count)
+        return first->count < second->count ? 1 : -1;
+    return first->index - second->index;
+}
+
+static void unpack_aligned(const int64_t *data, int bits, uint16_t *out,
+                           size_t from)
+{
+    size_t per_long = 64 / bits;
+    uint64_t mask = ((uint64_t) 1 << bits) - 1;
+
+    for (size_t i = from; i < SECTION_BLOCKS; i++) {
+        uint64_t word = (uint64_t) data[i / per_long];
+        out[i] = word >> (i % per_long * bits) & mask;
+    }
+}
+
+static void unpack_straddling(const int64_t *data, int bits, uint16_t *out,
+                              size_t from)
+{
+    uint64_t mask = ((uint64_t) 1 << bits) - 1;
+
+    for (size_t i = from; i < SECTION_BLOCKS; i++) {
+        size_t bit = i * bits;
+        size_t offset = bit % 64;
+        uint64_t value = (uint64_t) data[bit / 64] >> offset;
+
+        if (offset + bits > 64)
+            value |= (uint64_t) data[bit / 64 + 1] << (64 - offset);
+        out[i] = value & mask;
+    }
+}
+
+#ifdef HAVE_AVX2_PATH
+
+// The answer is read from what libgcc found at startup, so it is cheap to
+// ask for every section and safe from any thread
+static uint8_t has_avx2()
+{
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+// Each 32 bit lane gets the four bytes its entry starts in, shifted down by
+// the entry's offset into the first byte. Entries are at most 12 bits, so
+// they always fit. The control only depends on where each lane's entries
+// start within the 16 bytes its half of the register was loaded from.
+static void lane_control(const size_t start[UNPACK_STEP], uint8_t *shuffle,
+                         uint32_t *shift)
+{
+    for (int lane = 0; lane < UNPACK_STEP; lane++) {
+        size_t byte = start[lane] / 8;
+        for (int i = 0; i < 4; i++)
+            shuffle[lane * 4 + i] = byte + i < 16 ? byte + i : 0x80;
+        shift[lane] = start[lane] % 8;
+    }
+}
+
+__attribute__((target("avx2"))) static inline void
+store_lanes(__m256i values, uint16_t *out)
+{
+    // Narrowing works within each half, so the two halves are joined after
+    __m256i packed = _mm256_packus_epi32(values, values);
+    packed = _mm256_permute4x64_epi64(packed, 0x08);
+    _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(packed));
+}
+
+// Every long is broadcast to both halves of a register and its entries are
+// pulled out eight at a time. Returns how many entries it unpacked.
+__attribute__((target("avx2"))) static size_t
+unpack_aligned_avx2(const int64_t *data, int bits, uint16_t *out)
+{
+    size_t per_long = 64 / bits;
+    size_t groups = (per_long + UNPACK_STEP - 1) / UNPACK_STEP;
+    uint8_t shuffle[UNPACK_GROUPS][32];
+    uint32_t shift[UNPACK_GROUPS][UNPACK_STEP];
+    __m256i controls[UNPACK_GROUPS], shifts[UNPACK_GROUPS];
+    __m256i mask = _mm256_set1_epi32((1 << bits) - 1);
+
+    for (size_t group = 0; group < groups; group++) {
+        size_t start[UNPACK_STEP];
+        for (int lane = 0; lane < UNPACK_STEP; lane++)
+            start[lane] = (group * UNPACK_STEP + lane) * bits;
+        lane_control(start, shuffle[group], shift[group]);
+
+        // Entries past the end of a long read the zeros beyond it
+        for (int i = 0; i < 32; i++) {
+            if (shuffle[group][i] != 0x80 && shuffle[group][i] % 16 >= 8)
+                shuffle[group][i] = 0x80;
+        }
+        controls[group] = _mm256_loadu_si256((const __m256i *) shuffle[group]);
+        shifts[group] = _mm256_loadu_si256((const __m256i *) shift[group]);
+    }
+
+    // Only whole longs whose every store stays within the section
+    size_t done = 0;
+    for (size_t word = 0;
+         done + groups * UNPACK_STEP <= SECTION_BLOCKS; word++)
+    {
+        __m256i value = _mm256_set1_epi64x(data[word]);
+        for (size_t group = 0; group < groups; group++) {
+            __m256i lanes = _mm256_shuffle_epi8(value, controls[group]);
+            lanes = _mm256_srlv_epi32(lanes, shifts[group]);
+            store_lanes(_mm256_and_si256(lanes, mask),
+                        out + done + group * UNPACK_STEP);
+        }
+        done += per_long;
+    }
+    return done;
+}
+
+// Eight entries take exactly as many bytes as an entry has bits, so every
+// group of eight starts on a byte and needs the same control. The two
+// halves of the register load the bytes for four entries each.
+__attribute__((target("avx2"))) static size_t
+unpack_straddling_avx2(const int64_t *data, size_t length, int bits,
+                       uint16_t *out)
+{
+    const uint8_t *bytes = (const uint8_t *) data;
+    size_t size = length * sizeof(int64_t);
+    size_t half = 4 * bits / 8;
+    size_t start[UNPACK_STEP];
+    uint8_t shuffle[32];
+    uint32_t shift[UNPACK_STEP];
+
+    for (int lane = 0; lane < UNPACK_STEP; lane++)
+        start[lane] = lane < 4 ? lane * bits
+                               : lane * bits - half * 8;
+    lane_control(start, shuffle, shift);
+
+    __m256i control = _mm256_loadu_si256((const __m256i *) shuffle);
+    __m256i shifts = _mm256_loadu_si256((const __m256i *) shift);
+    __m256i mask = _mm256_set1_epi32((1 << bits) - 1);
+
+    size_t done = 0;
+    for (size_t offset = 0; done + UNPACK_STEP <= SECTION_BLOCKS &&
+                            offset + half + 16 <= size;
+         offset += bits)
+    {
+        __m256i value = _mm256_loadu2_m128i(
+            (const __m128i *) (bytes + offset + half),
+            (const __m128i *) (bytes + offset));
+        __m256i lanes = _mm256_shuffle_epi8(value, control);
+        lanes = _mm256_srlv_epi32(lanes, shifts);
+        store_lanes(_mm256_and_si256(lanes, mask), out + done);
+        done += UNPACK_STEP;
+    }
+    return done;
+}
+
+#endif
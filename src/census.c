@@ -0,0 +1,269 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ast.h>
+#include <blocks.h>
+#include <census.h>
+
+//// VARIABLES ////
+
+// Everything a census reads from a chunk, before and after 1.18. Entities
+// have had region files of their own since 1.17.
+const char *const census_paths[] = {
+    "sections.block_states.palette.Name",
+    "sections.block_states.data",
+    "block_entities.id",
+    "Entities.id",
+    "Level.Sections.Palette.Name",
+    "Level.Sections.BlockStates",
+    "Level.Entities.id",
+    "Level.TileEntities.id",
+    NULL,
+};
+
+static const char *kind_names[] = {"blocks", "entities", "block entities"};
+
+// Each thread counts into its own tables, merged once it runs out of work
+static _Thread_local Census_t local = {0};
+
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//// DECLARATIONS ////
+
+static int count_sections(Named_tag_t *chunk);
+static void count_ids(Tag_list_t *list, int kind);
+static Tag_list_t *chunk_list(Tag_t *root, const char *name,
+                              const char *legacy_name);
+
+static void table_add(Census_table_t *table, const char *name,
+                      size_t length, uint64_t count);
+static Census_entry_t *table_slot(Census_table_t *table, const char *name,
+                                  size_t length, uint64_t hash);
+static void table_free(Census_table_t *table);
+static uint64_t hash_name(const char *name, size_t length);
+static int compare_entries(const void *a, const void *b);
+
+//// DEFINITIONS ////
+
+void census_init(Census_t *census)
+{
+    memset(census, 0, sizeof(*census));
+}
+
+// Counts a chunk decoded with census_paths into the calling thread's tables
+int census_count(Named_tag_t *chunk)
+{
+    Tag_t *root = chunk->tag;
+
+    local.chunks++;
+    count_ids(chunk_list(root, "Entities", "Entities"), CENSUS_ENTITIES);
+    count_ids(chunk_list(root, "block_entities", "TileEntities"),
+              CENSUS_BLOCK_ENTITIES);
+    return count_sections(chunk);
+}
+
+// Hands the calling thread's counts over and frees its tables
+void census_end(Census_t *into)
+{
+    pthread_mutex_lock(&merge_lock);
+
+    for (int kind = 0; kind < CENSUS_KINDS; kind++) {
+        Census_table_t *table = local.tables + kind;
+        for (size_t i = 0; i < table->capacity; i++) {
+            Census_entry_t *entry = table->entries + i;
+            if (entry->name)
+                table_add(into->tables + kind, entry->name, entry->length,
+                          entry->count);
+        }
+    }
+    into->chunks += local.chunks;
+
+    pthread_mutex_unlock(&merge_lock);
+
+    census_free(&local);
+}
+
+// Lists every kind by count, most common first
+void census_print(const Census_t *census, FILE *stream)
+{
+    fprintf(stream, "chunks: %zu\n", census->chunks);
+
+    for (int kind = 0; kind < CENSUS_KINDS; kind++) {
+        const Census_table_t *table = census->tables + kind;
+        Census_entry_t *sorted = (Census_entry_t *) malloc(
+            (table->length ? table->length : 1) * sizeof(Census_entry_t));
+        size_t length = 0;
+
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->entries[i].name)
+                sorted[length++] = table->entries[i];
+        }
+        qsort(sorted, length, sizeof(Census_entry_t), compare_entries);
+
+        fprintf(stream, "%s:\n", kind_names[kind]);
+        for (size_t i = 0; i < length; i++)
+            fprintf(stream, "%12" PRIu64 " %s\n", sorted[i].count,
+                    sorted[i].name);
+        free(sorted);
+    }
+}
+
+void census_free(Census_t *census)
+{
+    for (int kind = 0; kind < CENSUS_KINDS; kind++)
+        table_free(census->tables + kind);
+    census->chunks = 0;
+}
+
+// Blocks are counted per palette entry first, so each section only looks up
+// as many names as its palette has
+static int count_sections(Named_tag_t *chunk)
+{
+    Tag_t *position;
+    Tag_list_t *sections = blocks_sections(chunk, &position);
+    uint16_t blocks[SECTION_BLOCKS];
+    uint32_t counts[SECTION_BLOCKS];
+    int status = 0;
+
+    if (!sections)
+        return 0;
+
+    for (int32_t i = 0; i < sections->length; i++) {
+        Tag_list_t *palette;
+
+        if (blocks_section(sections->load[i], &palette, blocks) ||
+            (palette && palette->length > SECTION_BLOCKS))
+        {
+            status = -1;
+            continue;
+        }
+        if (!palette)
+            continue;
+
+        memset(counts, 0, palette->length * sizeof(uint32_t));
+        for (size_t j = 0; j < SECTION_BLOCKS; j++)
+            counts[blocks[j]]++;
+
+        for (int32_t j = 0; j < palette->length; j++) {
+            Tag_string_t *name = (Tag_string_t *) compound_get(
+                palette->load[j], "Name", TAG_String);
+            if (name && counts[j])
+                table_add(local.tables + CENSUS_BLOCKS,
+                          (const char *) name->load, name->length,
+                          counts[j]);
+        }
+    }
+    return status;
+}
+
+static void count_ids(Tag_list_t *list, int kind)
+{
+    if (!list || list->list_type != TAG_Compound)
+        return;
+
+    for (int32_t i = 0; i < list->length; i++) {
+        Tag_string_t *id =
+            (Tag_string_t *) compound_get(list->load[i], "id", TAG_String);
+        if (id)
+            table_add(local.tables + kind, (const char *) id->load,
+                      id->length, 1);
+    }
+}
+
+// Chunks before 1.18 keep their lists under Level, some by other names
+static Tag_list_t *chunk_list(Tag_t *root, const char *name,
+                              const char *legacy_name)
+{
+    Tag_t *list = compound_get(root, name, TAG_List);
+    Tag_t *level = compound_get(root, "Level", TAG_Compound);
+
+    if (!list && level)
+        list = compound_get(level, legacy_name, TAG_List);
+    return (Tag_list_t *) list;
+}
+
+static void table_add(Census_table_t *table, const char *name,
+                      size_t length, uint64_t count)
+{
+    uint64_t hash = hash_name(name, length);
+
+    // Tables grow at three quarters full, keeping probe runs short
+    if ((table->length + 1) * 4 > table->capacity * 3) {
+        Census_table_t grown;
+        grown.capacity = table->capacity ? table->capacity * 2
+                                         : CENSUS_PREALLOC;
+        grown.length = table->length;
+        grown.entries = (Census_entry_t *) calloc(grown.capacity,
+                                                  sizeof(Census_entry_t));
+
+        for (size_t i = 0; i < table->capacity; i++) {
+            Census_entry_t *entry = table->entries + i;
+            if (entry->name)
+                *table_slot(&grown, entry->name, entry->length,
+                            entry->hash) = *entry;
+        }
+        free(table->entries);
+        *table = grown;
+    }
+
+    Census_entry_t *entry = table_slot(table, name, length, hash);
+    if (!entry->name) {
+        entry->name = (char *) malloc(length + 1);
+        memcpy(entry->name, name, length);
+        entry->name[length] = 0x00;
+        entry->length = length;
+        entry->hash = hash;
+        table->length++;
+    }
+    entry->count += count;
+}
+
+// Finds the entry for the name, or the empty slot it would go in
+static Census_entry_t *table_slot(Census_table_t *table, const char *name,
+                                  size_t length, uint64_t hash)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Census_entry_t *entry = table->entries + i;
+        if (!entry->name ||
+            (entry->hash == hash && entry->length == length &&
+             !memcmp(entry->name, name, length)))
+            return entry;
+    }
+}
+
+static void table_free(Census_table_t *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+        free(table->entries[i].name);
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = table->length = 0;
+}
+
+// FNV-1a
+static uint64_t hash_name(const char *name, size_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const Census_entry_t *first = (const Census_entry_t *) a;
+    const Census_entry_t *second = (const Census_entry_t *) b;
+
+    if (first->count != second->count)
+        return first->count < second->count ? 1 : -1;
+    return strcmp(first->name, second->name);
+}
@@ -1,127 +1,295 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 #include <ast.h>
 #include <compress.h>
+#include <pool.h>
 #include <print.h>
+#include <zstream.h>
+
+//// STRUCTS ////
+
+typedef struct Deflate_block_s
+{
+    uint8_t *out;
+    size_t length;
+    uLong crc;
+    int status;
+} Deflate_block_t;
+
+typedef struct Parallel_deflate_s
+{
+    const uint8_t *data;
+    size_t length;
+    size_t count;
+    Deflate_block_t *blocks;
+} Parallel_deflate_t;
 
 //// VARIABLES ////
 
-static int buf_index = 0;
-static int buf_len = 0;
+static _Thread_local size_t buf_index = 0;
+static _Thread_local size_t buf_len = 0;
+
+static _Thread_local uint8_t *in_buf;
+static _Thread_local uint8_t *out_buf;
+static _Thread_local size_t out_len = 0;
+
+static _Thread_local z_stream deflater;
+static _Thread_local uint8_t deflater_ready = 0;
+
+static _Thread_local z_stream zlib_deflater;
+static _Thread_local uint8_t zlib_deflater_ready = 0;
+
+static _Thread_local z_stream block_deflater;
+static _Thread_local uint8_t block_deflater_ready = 0;
 
-static uint8_t *in_buf;
-static uint8_t *out_buf;
+// Layout of the numbers in binary output, Java's unless set otherwise
+static uint8_t format = NBT_JAVA;
 
-static void (*function_table[])(Tag_t *) = {
-    write_TAG_End,        write_TAG_Byte,       write_TAG_Short,
-    write_TAG_Int,        write_TAG_Long,       write_TAG_Float,
-    write_TAG_Double,     write_TAG_Byte_Array, write_TAG_String,
-    write_TAG_List,       write_TAG_Compound,   write_TAG_Int_Array,
-    write_TAG_Long_Array,
-};
+// Whether roots are written without a name, as the network protocol does
+static uint8_t nameless = 0;
 
 //// DECLARATIONS ////
 
 static void next(uint8_t c);
+static int deflate_buffer(z_streamp strmp, const uint8_t *data,
+                          size_t input_length, size_t *out_length);
+static void deflate_block(void *ctx, size_t index);
+static void deflate_block_done(void *ctx);
+static void put_le32(uint8_t *out, uint32_t value);
+static void write_tree(Tag_t *root, uint8_t type);
+static void write_value(Tag_t *tag, uint8_t type);
 
 static void write_8b(void *ptr);
 static void write_16b(void *ptr);
 static void write_32b(void *ptr);
 static void write_64b(void *ptr);
+static void write_16l(void *ptr);
+static void write_32l(void *ptr);
+static void write_64l(void *ptr);
+static void write_varint(uint64_t value);
+
+static void write_short(void *ptr);
+static void write_int(void *ptr);
+static void write_long(void *ptr);
+static void write_float(void *ptr);
+static void write_double(void *ptr);
+static void write_string_length(uint16_t length);
 
 //// DEFINITIONS ////
 
-void nbt_compress(Named_tag_t *tag)
+int nbt_compress(Named_tag_t *tag, FILE *stream)
 {
-    z_stream strm = {0};
-    z_streamp strmp = &strm;
+    const uint8_t *data;
+    size_t length;
 
-    fprintf(stderr, _OK "Write to buffer was successful, %d bytes.\n" _CLEAR,
-            buf_index);
-    write_nbt_tag(tag);
+    if (nbt_serialise(tag, &data, &length))
+        return -1;
+    return nbt_deflate(data, length, stream);
+}
 
-    int input_length = buf_index;
+int nbt_serialise(Named_tag_t *tag, const uint8_t **data, size_t *length)
+{
+    buf_index = 0;
+    if (write_nbt_tag(tag))
+        return -1;
 
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.next_in = in_buf;
-    strm.avail_in = 0;
+    *data = in_buf;
+    *length = buf_index;
+    return 0;
+}
 
-    out_buf = NULL;
+int nbt_deflate(const uint8_t *data, size_t input_length, FILE *stream)
+{
+    size_t produced;
 
-    if (deflateInit2(strmp, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                     windowBits | ENABLE_GZIP, 8, Z_DEFAULT_STRATEGY))
+    // The deflate state is kept per thread and reset between outputs
+    if (deflater_ready)
+        deflateReset(&deflater);
+    else if (deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                          windowBits | ENABLE_GZIP, 8, Z_DEFAULT_STRATEGY))
     {
         fprintf(stderr, _ERR "Error!\n" _CLEAR);
-        return;
+        return -1;
     }
+    deflater_ready = 1;
 
-    // if (inflateInit2(strmp, windowBits | ENABLE_GZIP)) {
-    //     fprintf(stderr, _ERR "Error!\n" _CLEAR);
-    //     return NULL;
-    // }
+    if (deflate_buffer(&deflater, data, input_length, &produced))
+        return -1;
 
-    while (1) {
-        strm.avail_in = input_length;
-        strm.next_in = in_buf;
+    if (produced && fwrite(out_buf, produced, 1, stream) != 1) {
+        fprintf(stderr, _ERR "Error! Couldn't write output.\n" _CLEAR);
+        return -1;
+    }
+    return 0;
+}
 
-        // fprintf(stderr, _OK "New chunk of uncompressed data\n");
+// The zlib wrapper is what region files store chunks in. The output stays
+// valid until the next call on the same thread.
+int nbt_deflate_zlib(const uint8_t *data, size_t length, const uint8_t **out,
+                     size_t *out_length)
+{
+    if (zlib_deflater_ready)
+        deflateReset(&zlib_deflater);
+    else if (deflateInit2(&zlib_deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                          windowBits, 8, Z_DEFAULT_STRATEGY))
+    {
+        fprintf(stderr, _ERR "Error!\n" _CLEAR);
+        return -1;
+    }
+    zlib_deflater_ready = 1;
 
-        do {
-            strm.avail_out = input_length;
-            out_buf = realloc(out_buf, strm.total_out + input_length);
-            strm.next_out = out_buf + strm.total_out;
+    if (deflate_buffer(&zlib_deflater, data, length, out_length))
+        return -1;
+    *out = out_buf;
+    return 0;
+}
 
-            fprintf(stderr, _OK "Output buffer now has %ld bytes.\n",
-                    strm.total_out + input_length);
+// Splits the input into blocks that are deflated on separate threads, each
+// primed with the 32 KiB before it, like pigz. Every block but the last ends
+// on a byte boundary with a sync flush, so the raw outputs can simply be
+// concatenated between a gzip header and a trailer with the combined CRC.
+int nbt_deflate_parallel(const uint8_t *data, size_t length, FILE *stream,
+                         int threads)
+{
+    if (threads <= 1 || length < PARALLEL_MIN_SIZE)
+        return nbt_deflate(data, length, stream);
+
+    Parallel_deflate_t job;
+    job.data = data;
+    job.length = length;
+    job.count = (length + PARALLEL_BLOCK - 1) / PARALLEL_BLOCK;
+    job.blocks = (Deflate_block_t *) calloc(job.count,
+                                            sizeof(Deflate_block_t));
+
+    pool_run(threads, job.count, deflate_block, deflate_block_done, &job);
+
+    static const uint8_t header[GZIP_HEADER_SIZE] = {
+        0x1F, 0x8B, Z_DEFLATED, 0, 0, 0, 0, 0, 0, GZIP_OS_UNIX,
+    };
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    uLong crc = crc32(0, Z_NULL, 0);
+    int status = fwrite(header, sizeof(header), 1, stream) == 1 ? 0 : -1;
+
+    for (size_t i = 0; i < job.count; i++) {
+        Deflate_block_t *block = job.blocks + i;
+        size_t start = i * PARALLEL_BLOCK;
+        size_t size = length - start < PARALLEL_BLOCK ? length - start
+                                                      : PARALLEL_BLOCK;
+
+        if (block->status && !status) {
+            fprintf(stderr, _ERR "Gzip error %d.\n" _CLEAR, block->status);
+            status = -1;
+        }
+        if (!status && block->length &&
+            fwrite(block->out, block->length, 1, stream) != 1)
+            status = -1;
+        crc = crc32_combine(crc, block->crc, size);
+        free(block->out);
+    }
+    free(job.blocks);
 
-            int status = deflate(strmp, Z_FINISH);
+    put_le32(trailer, crc);
+    put_le32(trailer + 4, (uint32_t) length);
+    if (!status && fwrite(trailer, sizeof(trailer), 1, stream) != 1)
+        status = -1;
 
-            switch (status) {
-            case Z_OK:
-            case Z_STREAM_END:
-            case Z_BUF_ERROR:
-                break;
+    if (status)
+        fprintf(stderr, _ERR "Error! Couldn't write output.\n" _CLEAR);
+    return status;
+}
 
-            default:
-                deflateEnd(strmp);
-                fprintf(stderr, _ERR "Gzip error %d.\n" _CLEAR, status);
-                return;
-            }
+// Applies to every thread, so it is set before any start encoding
+void nbt_set_write_format(uint8_t new_format)
+{
+    format = new_format;
+}
+
+// Like the format, shared by every thread and set before encoding starts
+void nbt_set_write_nameless(uint8_t new_nameless)
+{
+    nameless = new_nameless;
+}
 
-        } while (strm.avail_out == 0);
+void nbt_compress_end()
+{
+    if (deflater_ready)
+        deflateEnd(&deflater);
+    deflater_ready = 0;
+    if (zlib_deflater_ready)
+        deflateEnd(&zlib_deflater);
+    zlib_deflater_ready = 0;
+    deflate_block_done(NULL);
 
-        if (strm.total_in >= input_length) {
-            deflateEnd(strmp);
-            break;
+    free(in_buf);
+    free(out_buf);
+    in_buf = out_buf = NULL;
+    buf_len = out_len = 0;
+}
+
+// Deflates into the per-thread output buffer, which grows as needed
+static int deflate_buffer(z_streamp strmp, const uint8_t *data,
+                          size_t input_length, size_t *out_length)
+{
+    size_t consumed = 0, produced = 0;
+
+    strmp->next_in = Z_NULL;
+    strmp->avail_in = 0;
+
+    // zlib counts in 32 bits, so buffers past 4 GiB are fed in pieces
+    while (1) {
+        if (produced == out_len) {
+            out_len = out_len ? out_len * 2 : input_length / 4 + CHUNK;
+            out_buf = realloc(out_buf, out_len);
         }
-    }
+        if (!strmp->avail_in) {
+            strmp->next_in = (uint8_t *) data + consumed;
+            strmp->avail_in = ZLIB_AVAIL(input_length - consumed);
+            consumed += strmp->avail_in;
+        }
+        strmp->next_out = out_buf + produced;
+        strmp->avail_out = ZLIB_AVAIL(out_len - produced);
 
-    fprintf(stderr,
-            _CLEAR _OK "Compressed successfully, %ld bytes.\n" _CLEAR,
-            strm.total_out);
+        uInt avail_out = strmp->avail_out;
+        int status = deflate(strmp,
+                             consumed < input_length ? Z_NO_FLUSH : Z_FINISH);
+        produced += avail_out - strmp->avail_out;
 
-    fwrite(out_buf, strm.total_out, 1, stdout);
+        if (status == Z_STREAM_END)
+            break;
+        if (status == Z_OK || status == Z_BUF_ERROR)
+            continue;
 
-    free(in_buf);
-    free(out_buf);
+        fprintf(stderr, _ERR "Gzip error %d.\n" _CLEAR, status);
+        return -1;
+    }
+
+    *out_length = produced;
+    return 0;
 }
 
-void write_nbt_tag(Named_tag_t *ptr)
+// Nameless roots may be of any type, and one of TAG_End is just its type
+int write_nbt_tag(Named_tag_t *ptr)
 {
+    if (nameless) {
+        write_8b(&ptr->type);
+        if (ptr->type != TAG_End)
+            write_value(ptr->tag, ptr->type);
+        return 0;
+    }
     if (ptr->type != TAG_Compound) {
-        fprintf(stderr, _ERR "Error! Root tag is not compound." _CLEAR);
-        return;
+        fprintf(stderr, _ERR "Error! Root tag is not compound.\n" _CLEAR);
+        return -1;
     }
     write_8b(&ptr->type);
 
     write_TAG_String((Tag_t *) ptr->name);
 
-    function_table[ptr->type](ptr->tag);
+    write_tree(ptr->tag, ptr->type);
+    return 0;
 }
 
 void write_TAG(Named_tag_t *ptr)
@@ -130,7 +298,7 @@ void write_TAG(Named_tag_t *ptr)
 
     write_TAG_String((Tag_t *) ptr->name);
 
-    function_table[ptr->type](ptr->tag);
+    write_value(ptr->tag, ptr->type);
 }
 
 void write_TAG_End(Tag_t *ptr)
@@ -147,37 +315,37 @@ void write_TAG_Byte(Tag_t *ptr)
 void write_TAG_Short(Tag_t *ptr)
 {
     Tag_short_t *tag = (Tag_short_t *) ptr;
-    write_16b(&tag->load);
+    write_short(&tag->load);
 }
 
 void write_TAG_Int(Tag_t *ptr)
 {
     Tag_int_t *tag = (Tag_int_t *) ptr;
-    write_32b(&tag->load);
+    write_int(&tag->load);
 }
 
 void write_TAG_Long(Tag_t *ptr)
 {
     Tag_long_t *tag = (Tag_long_t *) ptr;
-    write_64b(&tag->load);
+    write_long(&tag->load);
 }
 
 void write_TAG_Float(Tag_t *ptr)
 {
     Tag_float_t *tag = (Tag_float_t *) ptr;
-    write_32b(&tag->load);
+    write_float(&tag->load);
 }
 
 void write_TAG_Double(Tag_t *ptr)
 {
     Tag_double_t *tag = (Tag_double_t *) ptr;
-    write_64b(&tag->load);
+    write_double(&tag->load);
 }
 
 void write_TAG_Byte_Array(Tag_t *ptr)
 {
     Tag_byte_array_t *tag = (Tag_byte_array_t *) ptr;
-    write_32b(&tag->length);
+    write_int(&tag->length);
 
     for (int i = 0; i < tag->length; i++) {
         write_8b(tag->load + i);
@@ -187,7 +355,7 @@ void write_TAG_Byte_Array(Tag_t *ptr)
 void write_TAG_String(Tag_t *ptr)
 {
     Tag_string_t *tag = (Tag_string_t *) ptr;
-    write_16b(&tag->length);
+    write_string_length(tag->length);
 
     for (int i = 0; i < tag->length; i++) {
         write_8b(tag->load + i);
@@ -196,43 +364,114 @@ void write_TAG_String(Tag_t *ptr)
 
 void write_TAG_List(Tag_t *ptr)
 {
-    Tag_list_t *tag = (Tag_list_t *) ptr;
-    write_8b(&tag->list_type);
-    write_32b(&tag->length);
-
-    for (int i = 0; i < tag->length; i++) {
-        function_table[tag->list_type](tag->load[i]);
-    }
+    write_tree(ptr, TAG_List);
 }
 
 void write_TAG_Compound(Tag_t *ptr)
 {
-    Tag_compound_t *tag = (Tag_compound_t *) ptr;
-
-    for (int i = 0; tag->load[i]; i++) {
-        write_TAG(tag->load[i]);
-    }
-
-    write_TAG_End(NULL);
+    write_tree(ptr, TAG_Compound);
 }
 
 void write_TAG_Int_Array(Tag_t *ptr)
 {
     Tag_int_array_t *tag = (Tag_int_array_t *) ptr;
-    write_32b(&tag->length);
+    write_int(&tag->length);
 
-    for (int i = 0; i < tag->length; i++) {
-        write_32b(tag->load + i);
+    // Java arrays settle the format once rather than once per element
+    if (format == NBT_JAVA) {
+        for (int i = 0; i < tag->length; i++)
+            write_32b(tag->load + i);
+    }
+    else {
+        for (int i = 0; i < tag->length; i++)
+            write_int(tag->load + i);
     }
 }
 
 void write_TAG_Long_Array(Tag_t *ptr)
 {
     Tag_long_array_t *tag = (Tag_long_array_t *) ptr;
-    write_32b(&tag->length);
+    write_int(&tag->length);
 
-    for (int i = 0; i < tag->length; i++) {
-        write_64b(tag->load + i);
+    if (format == NBT_JAVA) {
+        for (int i = 0; i < tag->length; i++)
+            write_64b(tag->load + i);
+    }
+    else {
+        for (int i = 0; i < tag->length; i++)
+            write_long(tag->load + i);
+    }
+}
+
+// Headers are written on the way down and compound ends on the way back up,
+// with an explicit stack in place of recursion
+static void write_tree(Tag_t *root, uint8_t type)
+{
+    size_t base = walk_depth();
+
+    if (type == TAG_List) {
+        Tag_list_t *list = (Tag_list_t *) root;
+        write_8b(&list->list_type);
+        write_int(&list->length);
+    }
+    walk_push(type, root);
+
+    while (walk_depth() > base) {
+        Walk_frame_t *frame = walk_top();
+        Tag_t *child;
+
+        if (frame->type == TAG_Compound) {
+            Tag_compound_t *tag = (Tag_compound_t *) frame->tag;
+            Named_tag_t *member = tag->load[frame->index++];
+            if (!member) {
+                write_TAG_End(NULL);
+                walk_pop();
+                continue;
+            }
+            write_8b(&member->type);
+            write_TAG_String((Tag_t *) member->name);
+            child = member->tag;
+            type = member->type;
+        }
+        else {
+            Tag_list_t *tag = (Tag_list_t *) frame->tag;
+            if (frame->index == tag->length) {
+                walk_pop();
+                continue;
+            }
+            child = tag->load[frame->index++];
+            type = tag->list_type;
+        }
+
+        if (type == TAG_List) {
+            Tag_list_t *list = (Tag_list_t *) child;
+            write_8b(&list->list_type);
+            write_int(&list->length);
+            walk_push(type, child);
+        }
+        else if (type == TAG_Compound)
+            walk_push(type, child);
+        else
+            write_value(child, type);
+    }
+}
+
+static void write_value(Tag_t *tag, uint8_t type)
+{
+    switch (type) {
+    case TAG_End:        write_TAG_End(tag); break;
+    case TAG_Byte:       write_TAG_Byte(tag); break;
+    case TAG_Short:      write_TAG_Short(tag); break;
+    case TAG_Int:        write_TAG_Int(tag); break;
+    case TAG_Long:       write_TAG_Long(tag); break;
+    case TAG_Float:      write_TAG_Float(tag); break;
+    case TAG_Double:     write_TAG_Double(tag); break;
+    case TAG_Byte_Array: write_TAG_Byte_Array(tag); break;
+    case TAG_String:     write_TAG_String(tag); break;
+    case TAG_List:
+    case TAG_Compound:   write_tree(tag, type); break;
+    case TAG_Int_Array:  write_TAG_Int_Array(tag); break;
+    case TAG_Long_Array: write_TAG_Long_Array(tag); break;
     }
 }
 
@@ -242,16 +481,19 @@ static void write_8b(void *ptr)
     next(r);
 }
 
+// Loaded with memcpy, as floats and doubles are written through these too
 static void write_16b(void *ptr)
 {
-    uint16_t r = *(uint16_t *) ptr;
+    uint16_t r;
+    memcpy(&r, ptr, sizeof(r));
     next(r >> 8);
     next(r);
 }
 
 static void write_32b(void *ptr)
 {
-    uint32_t r = *(uint32_t *) ptr;
+    uint32_t r;
+    memcpy(&r, ptr, sizeof(r));
     next(r >> 24);
     next(r >> 16);
     next(r >> 8);
@@ -260,7 +502,8 @@ static void write_32b(void *ptr)
 
 static void write_64b(void *ptr)
 {
-    uint64_t r = *(uint64_t *) ptr;
+    uint64_t r;
+    memcpy(&r, ptr, sizeof(r));
     next(r >> 56);
     next(r >> 48);
     next(r >> 40);
@@ -271,10 +514,169 @@ static void write_64b(void *ptr)
     next(r);
 }
 
+static void write_16l(void *ptr)
+{
+    uint16_t r;
+    memcpy(&r, ptr, sizeof(r));
+    next(r);
+    next(r >> 8);
+}
+
+static void write_32l(void *ptr)
+{
+    uint32_t r;
+    memcpy(&r, ptr, sizeof(r));
+    for (int shift = 0; shift < 32; shift += 8)
+        next(r >> shift);
+}
+
+static void write_64l(void *ptr)
+{
+    uint64_t r;
+    memcpy(&r, ptr, sizeof(r));
+    for (int shift = 0; shift < 64; shift += 8)
+        next(r >> shift);
+}
+
+static void write_varint(uint64_t value)
+{
+    while (value >= 0x80) {
+        next(value | 0x80);
+        value >>= 7;
+    }
+    next(value);
+}
+
+// Numbers in the order of the format, as the decoder reads them
+static void write_short(void *ptr)
+{
+    if (format == NBT_JAVA)
+        write_16b(ptr);
+    else
+        write_16l(ptr);
+}
+
+static void write_int(void *ptr)
+{
+    if (format == NBT_JAVA)
+        write_32b(ptr);
+    else if (format == NBT_BEDROCK)
+        write_32l(ptr);
+    else {
+        int32_t n;
+        memcpy(&n, ptr, sizeof(n));
+        write_varint((uint32_t) n << 1 ^ (uint32_t) (n >> 31));
+    }
+}
+
+static void write_long(void *ptr)
+{
+    if (format == NBT_JAVA)
+        write_64b(ptr);
+    else if (format == NBT_BEDROCK)
+        write_64l(ptr);
+    else {
+        int64_t n;
+        memcpy(&n, ptr, sizeof(n));
+        write_varint((uint64_t) n << 1 ^ (uint64_t) (n >> 63));
+    }
+}
+
+static void write_float(void *ptr)
+{
+    if (format == NBT_JAVA)
+        write_32b(ptr);
+    else
+        write_32l(ptr);
+}
+
+static void write_double(void *ptr)
+{
+    if (format == NBT_JAVA)
+        write_64b(ptr);
+    else
+        write_64l(ptr);
+}
+
+static void write_string_length(uint16_t length)
+{
+    if (format == NBT_NETWORK)
+        write_varint(length);
+    else
+        write_short(&length);
+}
+
+static void deflate_block(void *ctx, size_t index)
+{
+    Parallel_deflate_t *job = (Parallel_deflate_t *) ctx;
+    Deflate_block_t *block = job->blocks + index;
+    z_streamp strmp = &block_deflater;
+
+    size_t start = index * PARALLEL_BLOCK;
+    size_t size = job->length - start < PARALLEL_BLOCK ? job->length - start
+                                                       : PARALLEL_BLOCK;
+    uint8_t last = index == job->count - 1;
+
+    // Raw deflate, as the gzip framing is written once around all blocks
+    if (block_deflater_ready)
+        deflateReset(strmp);
+    else if ((block->status = deflateInit2(strmp, Z_DEFAULT_COMPRESSION,
+                                           Z_DEFLATED, -windowBits, 8,
+                                           Z_DEFAULT_STRATEGY)))
+        return;
+    block_deflater_ready = 1;
+
+    if (start) {
+        size_t dictionary = start < PARALLEL_DICT ? start : PARALLEL_DICT;
+        deflateSetDictionary(strmp, job->data + start - dictionary,
+                             dictionary);
+    }
+
+    size_t capacity = deflateBound(strmp, size) + PARALLEL_FLUSH_MARGIN;
+    block->out = (uint8_t *) malloc(capacity);
+    block->crc = crc32(0, job->data + start, size);
+
+    strmp->next_in = (uint8_t *) job->data + start;
+    strmp->avail_in = size;
+
+    while (1) {
+        strmp->next_out = block->out + block->length;
+        strmp->avail_out = capacity - block->length;
+
+        int status = deflate(strmp, last ? Z_FINISH : Z_SYNC_FLUSH);
+        block->length = capacity - strmp->avail_out;
+
+        if (last ? status == Z_STREAM_END
+                 : status == Z_OK && strmp->avail_out)
+            break;
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            block->status = status;
+            break;
+        }
+        capacity *= 2;
+        block->out = (uint8_t *) realloc(block->out, capacity);
+    }
+}
+
+static void deflate_block_done(void *ctx)
+{
+    if (block_deflater_ready)
+        deflateEnd(&block_deflater);
+    block_deflater_ready = 0;
+}
+
+static void put_le32(uint8_t *out, uint32_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
 static void next(uint8_t c)
 {
     if (buf_index >= buf_len) {
-        buf_len += CHUNK;
+        buf_len = buf_len ? buf_len * 2 : CHUNK;
         in_buf = realloc(in_buf, buf_len);
     }
     in_buf[buf_index++] = c;
@@ -1,130 +1,599 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 #include <ast.h>
 #include <decompress.h>
 #include <print.h>
+#include <zstream.h>
+
+//// STRUCTS ////
+
+enum SELECT_STATUS
+{
+    SELECT_SKIP,
+    SELECT_SOME,
+    SELECT_ALL,
+};
+
+// Root tags decoded one after another, either straight from memory or from
+// compressed input inflated a buffer at a time. With a second thread the
+// buffers form a ring the producer fills in order and the decoder hands
+// back once it has read each.
+struct Nbt_stream_s
+{
+    // Where the decoder left off between roots
+    const uint8_t *window;
+    size_t index;
+    size_t length;
+    size_t offset;
+    uint8_t started;
+    uint8_t done;
+
+    const uint8_t *data;
+    size_t data_length;
+    uint8_t compressed;
+    z_stream strm;
+    size_t fed;
+    atomic_size_t consumed;
+
+    // Checkpoints made every span bytes of output. A stream resumed from
+    // one inflates raw deflate until the end of its member.
+    size_t span;
+    size_t inflated;
+    uint8_t trailer;
+    uint8_t raw;
+    Inflate_point_t *points;
+    size_t points_length;
+    size_t points_capacity;
+
+    // Anything but Z_OK ends the inflated stream
+    int status;
+    const char *message;
+    size_t error_location;
+
+    uint8_t *buffers[STREAM_BUFFERS];
+    size_t filled[STREAM_BUFFERS];
+    uint8_t ready[STREAM_BUFFERS];
+    size_t next_slot;
+    uint8_t threaded;
+    uint8_t finished;
+    uint8_t cancelled;
+
+    pthread_t producer;
+    pthread_mutex_t lock;
+    pthread_cond_t produced;
+    pthread_cond_t released;
+};
 
 //// VARIABLES ////
 
-static int buf_index = 0;
-static int buf_len = 0;
+static _Thread_local size_t buf_index = 0;
+static _Thread_local size_t buf_len = 0;
 
-static uint8_t in_buf[CHUNK];
-static uint8_t *out_buf;
+static _Thread_local const uint8_t *out_buf;
 
-static Tag_t *(*function_table[])() = {
-    read_TAG_End,        read_TAG_Byte,  read_TAG_Short,    read_TAG_Int,
-    read_TAG_Long,       read_TAG_Float, read_TAG_Double,   read_TAG_Byte_Array,
-    read_TAG_String,     read_TAG_List,  read_TAG_Compound, read_TAG_Int_Array,
-    read_TAG_Long_Array,
+// Offset of out_buf within the whole document, which is only ever non-zero
+// while decoding from a stream
+static _Thread_local size_t buf_offset = 0;
+static _Thread_local Nbt_stream_t *active_stream = NULL;
+
+static _Thread_local z_stream inflater;
+static _Thread_local uint8_t inflater_ready = 0;
+
+static _Thread_local Decode_error_t decode_error = {0};
+
+// Fewest bytes a payload of each type can occupy, used to bound lengths.
+// Varints take as little as a byte.
+static const size_t payload_sizes[][TAG_Long_Array + 1] = {
+    {1, 1, 2, 4, 8, 4, 8, 4, 2, 5, 1, 4, 4},
+    {1, 1, 2, 1, 1, 4, 8, 1, 1, 2, 1, 1, 1},
 };
+static const size_t *min_payload_size = payload_sizes[0];
+
+// Layout of the numbers in binary input, Java's unless set otherwise
+static uint8_t format = NBT_JAVA;
+
+// Whether roots are written without a name, as the network protocol does
+static uint8_t nameless = 0;
+
+// Deepest nesting of compounds and lists the decoder accepts
+static size_t max_depth = DECODE_MAX_DEPTH;
+
+// Containers being decoded, innermost last. The stack lives on the heap so
+// nesting costs no C stack, and it is kept between documents.
+static _Thread_local Decode_frame_t *frames = NULL;
+static _Thread_local size_t frame_count = 0;
+static _Thread_local size_t frame_capacity = 0;
+
+// Containers being skipped, of which only the counts are needed
+static _Thread_local Skip_frame_t *skips = NULL;
+static _Thread_local size_t skip_capacity = 0;
+
+// Containers being walked, which may skip others on the way
+static _Thread_local Skip_frame_t *scans = NULL;
+static _Thread_local size_t scan_capacity = 0;
+
+// Dotted paths to decode, with list elements taking their list's path, and
+// the path of the member being looked at
+static _Thread_local const char *const *select_paths = NULL;
+static _Thread_local char select_path[DECODE_PATH_MAX];
 
 //// DECLARATIONS ////
 
 static uint8_t next();
+static uint8_t read_root(uint8_t *type, Tag_string_t **name);
+static void fail(int code, const char *message);
+static void prepend_path(const char *segment, size_t length);
+static uint8_t check_type(uint8_t type);
+static uint8_t check_length(int64_t length, size_t element_size);
+static uint8_t check_list(uint8_t list_type, int32_t length);
+static size_t gzip_isize(const uint8_t *data, size_t length);
+
+static Tag_t *read_tree(uint8_t type);
+static Tag_t *read_leaf(uint8_t type);
+static uint8_t open_frame(uint8_t type, Tag_string_t *name);
+static Tag_t *close_frame(Decode_frame_t *frame);
+static void prepend_index(int32_t index);
+static int select_member(const Decode_frame_t *frame,
+                         const Tag_string_t *name, size_t *length);
+static uint8_t skip_payload(uint8_t type);
+static uint8_t skip_value(uint8_t type, size_t *depth);
+static uint8_t skip_bytes(size_t count);
+static uint8_t skip_numbers(uint8_t type, size_t count);
+
+static uint8_t is_gzip_member(const uint8_t *data, size_t length);
+static int inflate_into(Nbt_stream_t *stream, uint8_t *out, size_t capacity,
+                        size_t *filled);
+static void *inflate_producer(void *arg);
+static void add_point(Nbt_stream_t *stream, size_t used);
+static void publish(Nbt_stream_t *stream, size_t slot, size_t filled,
+                    int status);
+static uint8_t refill();
+static uint8_t at_end();
+static void stream_load(Nbt_stream_t *stream);
+static void stream_save(Nbt_stream_t *stream);
+static uint8_t stream_drain(Nbt_stream_t *stream);
+
+static uint8_t walk_root(size_t depth,
+                         void (*visit)(void *ctx, const Nbt_node_t *node),
+                         void *ctx);
+static uint8_t follow_path(uint8_t *type, const Path_segment_t *path,
+                           size_t count);
+static uint8_t skip_elements(uint8_t type, int32_t count);
+static uint8_t push_scan(uint8_t type, size_t depth);
 
 static void read_8b(void *ptr);
 static void read_16b(void *ptr);
 static void read_32b(void *ptr);
 static void read_64b(void *ptr);
+static void read_16l(void *ptr);
+static void read_32l(void *ptr);
+static void read_64l(void *ptr);
+static uint64_t read_varint(size_t max_bytes);
+
+static void read_short(void *ptr);
+static void read_int(void *ptr);
+static void read_long(void *ptr);
+static void read_float(void *ptr);
+static void read_double(void *ptr);
+static int32_t read_string_length();
 
 //// DEFINITIONS ////
 
-Named_tag_t *nbt_decompress()
+Named_tag_t *nbt_decompress(const uint8_t *data, size_t length)
 {
-    z_stream strm = {0};
-    z_streamp strmp = &strm;
+    return nbt_decompress_only(data, length, NULL);
+}
 
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.next_in = in_buf;
-    strm.avail_in = 0;
+Named_tag_t *nbt_decompress_only(const uint8_t *data, size_t length,
+                                 const char *const *paths)
+{
+    uint8_t *inflated;
+    size_t inflated_length;
 
-    out_buf = NULL;
+    // Uncompressed NBT is decoded straight from the input
+    if (!nbt_is_compressed(data, length))
+        return nbt_decode_only(data, length, paths);
 
-    if (inflateInit2(strmp, windowBits | ENABLE_GZIP)) {
-        fprintf(stderr, _ERR "Error!\n" _CLEAR);
+    if (nbt_inflate(data, length, &inflated, &inflated_length))
         return NULL;
-    }
 
-    while (1) {
-        int bytes_read = fread(in_buf, 1, CHUNK, stdin);
-        strm.avail_in = bytes_read;
-        strm.next_in = in_buf;
+    Named_tag_t *tag = nbt_decode_only(inflated, inflated_length, paths);
+
+    free(inflated);
+    return tag;
+}
 
-        fprintf(stderr, _OK "New chunk of compressed data\n");
+uint8_t nbt_is_compressed(const uint8_t *data, size_t length)
+{
+    if (length < 2)
+        return 0;
+    if (data[0] == GZIP_MAGIC_0)
+        return data[1] == GZIP_MAGIC_1;
+    return data[0] == ZLIB_MAGIC;
+}
 
-        do {
-            strm.avail_out = CHUNK;
-            out_buf = realloc(out_buf, strm.total_out + CHUNK);
-            strm.next_out = out_buf + strm.total_out;
+int nbt_inflate(const uint8_t *data, size_t length, uint8_t **out,
+                size_t *out_length)
+{
+    z_streamp strmp = &inflater;
+    size_t capacity = gzip_isize(data, length);
+    uint8_t *inflated = capacity ? malloc(capacity) : NULL;
 
-            fprintf(stderr, _OK "Output buffer now has %ld bytes.\n",
-                    strm.total_out + CHUNK);
+    size_t consumed = 0, produced = 0;
 
-            int status = inflate(strmp, Z_NO_FLUSH);
+    decode_error.code = DECODE_OK;
 
-            switch (status) {
-            case Z_OK:
-            case Z_STREAM_END:
-            case Z_BUF_ERROR:
-                break;
+    // The inflate state is kept per thread and reset between inputs
+    if (inflater_ready)
+        inflateReset(strmp);
+    else if (inflateInit2(strmp, windowBits | ENABLE_ZLIB_GZIP)) {
+        fail(DECODE_INFLATE, "Couldn't initialise zlib.");
+        free(inflated);
+        return -1;
+    }
+    inflater_ready = 1;
+    strmp->next_in = Z_NULL;
+    strmp->avail_in = 0;
 
-            default:
-                inflateEnd(strmp);
-                fprintf(stderr, _ERR "Gzip error %d.\n" _CLEAR, status);
-                return NULL;
-            }
+    // With a trustworthy ISIZE this finishes in a single call, otherwise the
+    // output buffer keeps growing until the stream ends. zlib counts in
+    // 32 bits, so buffers past 4 GiB are handed over in pieces.
+    while (1) {
+        if (produced == capacity) {
+            capacity = capacity ? capacity * 2 : CHUNK;
+            inflated = realloc(inflated, capacity);
+        }
+        if (!strmp->avail_in) {
+            strmp->next_in = (uint8_t *) data + consumed;
+            strmp->avail_in = ZLIB_AVAIL(length - consumed);
+            consumed += strmp->avail_in;
+        }
+        strmp->next_out = inflated + produced;
+        strmp->avail_out = ZLIB_AVAIL(capacity - produced);
 
-        } while (strm.avail_out == 0);
+        uInt avail_out = strmp->avail_out;
+        int status = inflate(strmp, Z_FINISH);
+        produced += avail_out - strmp->avail_out;
 
-        if (feof(stdin)) {
-            inflateEnd(strmp);
-            break;
+        if (status == Z_STREAM_END) {
+            // Another gzip member may follow the end of this one
+            size_t used = consumed - strmp->avail_in;
+            if (!is_gzip_member(data + used, length - used))
+                break;
+            inflateReset(strmp);
+            continue;
         }
+        if (status == Z_OK || (status == Z_BUF_ERROR &&
+                               (!strmp->avail_out || consumed < length)))
+            continue;
+
+        free(inflated);
+        decode_error.location = consumed - strmp->avail_in;
+        if (status == Z_BUF_ERROR)
+            fail(DECODE_INFLATE, "Truncated compressed input.");
+        else
+            fail(DECODE_INFLATE,
+                 strmp->msg ? strmp->msg : "Corrupt compressed input.");
+        return -1;
     }
 
-    fprintf(stderr,
-            _CLEAR _OK "Decompressed successfully, %ld bytes.\n" _CLEAR,
-            strm.total_out);
+    *out = inflated;
+    *out_length = produced;
+    return 0;
+}
 
+Named_tag_t *nbt_decode(const uint8_t *data, size_t length)
+{
+    size_t used;
+    return nbt_decode_slice(data, length, &used);
+}
+
+// Decodes the root at the start of the slice, which may be followed by
+// anything else, such as the rest of a packet. used is left with the bytes
+// the root took up.
+Named_tag_t *nbt_decode_slice(const uint8_t *data, size_t length,
+                              size_t *used)
+{
     buf_index = 0;
-    buf_len = strm.total_out;
+    buf_len = length;
+    buf_offset = 0;
+    out_buf = data;
+
+    decode_error.code = DECODE_OK;
+    decode_error.path_start = DECODE_PATH_MAX - 1;
+    decode_error.path[decode_error.path_start] = 0x00;
+
     Named_tag_t *tag = read_nbt_tag();
+    *used = buf_index;
+    return tag;
+}
 
-    free(out_buf);
+// Decodes only the members of the root on one of the paths, such as
+// "Level.Sections", and what lies below them. Everything else is stepped
+// over without being allocated.
+Named_tag_t *nbt_decode_only(const uint8_t *data, size_t length,
+                             const char *const *paths)
+{
+    select_paths = paths;
+    Named_tag_t *tag = nbt_decode(data, length);
+    select_paths = NULL;
     return tag;
 }
 
-Named_tag_t *read_nbt_tag()
+// Compressed input is inflated as it is decoded, so memory stays bounded
+// however many roots follow each other. With more than one thread that
+// happens on a producer thread, which blocks when every buffer is full.
+Nbt_stream_t *nbt_stream_open(const uint8_t *data, size_t length,
+                              int threads)
 {
-    enum TAG_TYPE type = (enum TAG_TYPE) next();
-    Tag_string_t *name = (Tag_string_t *) read_TAG_String();
+    return nbt_stream_open_points(data, length, threads, 0);
+}
 
-    if (type != TAG_Compound) {
-        fprintf(stderr, _ERR "Error! Root tag is not compound." _CLEAR);
+// Also makes a checkpoint every span bytes of inflated output, for streams
+// resumed later on
+Nbt_stream_t *nbt_stream_open_points(const uint8_t *data, size_t length,
+                                     int threads, size_t span)
+{
+    Nbt_stream_t *stream = (Nbt_stream_t *) calloc(1, sizeof(Nbt_stream_t));
+
+    decode_error.code = DECODE_OK;
+    stream->data = data;
+    stream->data_length = length;
+    stream->compressed = nbt_is_compressed(data, length);
+    stream->span = span;
+    stream->trailer = is_gzip_member(data, length) ? 8 : 4;
+    atomic_init(&stream->consumed, 0);
+
+    if (!stream->compressed) {
+        stream->window = data;
+        stream->length = length;
+        return stream;
+    }
+
+    if (inflateInit2(&stream->strm, windowBits | ENABLE_ZLIB_GZIP)) {
+        fail(DECODE_INFLATE, "Couldn't initialise zlib.");
+        free(stream);
         return NULL;
     }
-    return new_named_tag(type, name, function_table[type]());
+    stream->status = Z_OK;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->produced, NULL);
+    pthread_cond_init(&stream->released, NULL);
+
+    // Without a second thread the decoder inflates each buffer itself
+    stream->threaded = threads > 1;
+    for (int i = 0; i < (stream->threaded ? STREAM_BUFFERS : 1); i++)
+        stream->buffers[i] = (uint8_t *) malloc(STREAM_BUFFER);
+    if (stream->threaded &&
+        pthread_create(&stream->producer, NULL, inflate_producer, stream))
+        stream->threaded = 0;
+
+    return stream;
+}
+
+// Inflates from a checkpoint instead of the start, on the calling thread.
+// Offsets carry on from the checkpoint's, so only nbt_stream_get reads it.
+Nbt_stream_t *nbt_stream_resume(const uint8_t *data, size_t length,
+                                const Inflate_point_t *point)
+{
+    decode_error.code = DECODE_OK;
+    if (point->in > length || point->bits > 7 || (point->bits && !point->in) ||
+        point->window_length > INFLATE_WINDOW)
+    {
+        fail(DECODE_SEEK, "Invalid checkpoint.");
+        return NULL;
+    }
+
+    Nbt_stream_t *stream = (Nbt_stream_t *) calloc(1, sizeof(Nbt_stream_t));
+    z_streamp strmp = &stream->strm;
+
+    stream->data = data;
+    stream->data_length = length;
+    stream->compressed = 1;
+    stream->started = 1;
+    stream->offset = stream->inflated = point->out;
+    stream->fed = point->in;
+    stream->trailer = point->trailer;
+    stream->raw = 1;
+    atomic_init(&stream->consumed, point->in);
+
+    if (inflateInit2(strmp, -windowBits)) {
+        fail(DECODE_INFLATE, "Couldn't initialise zlib.");
+        free(stream);
+        return NULL;
+    }
+    if ((point->bits &&
+         inflatePrime(strmp, point->bits,
+                      data[point->in - 1] >> (8 - point->bits))) ||
+        inflateSetDictionary(strmp, point->window, point->window_length))
+    {
+        fail(DECODE_SEEK, "Invalid checkpoint.");
+        inflateEnd(strmp);
+        free(stream);
+        return NULL;
+    }
+
+    stream->status = Z_OK;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->produced, NULL);
+    pthread_cond_init(&stream->released, NULL);
+    stream->buffers[0] = (uint8_t *) malloc(STREAM_BUFFER);
+    return stream;
+}
+
+// Returns NULL once the stream ends, or on error. The whole input is still
+// inflated and checked before the last root is returned, and inflate errors
+// take precedence as the cause of whatever the decoder made of the bytes.
+Named_tag_t *nbt_stream_next(Nbt_stream_t *stream)
+{
+    if (stream->done) {
+        decode_error.code = DECODE_OK;
+        return NULL;
+    }
+    stream_load(stream);
+
+    // The first root is required, so that empty input is still an error.
+    // Nameless TAG_End roots hold nothing, and are stepped over.
+    Named_tag_t *tag = NULL;
+    do {
+        if (!stream->started || !at_end())
+            tag = read_nbt_tag();
+        stream->started = 1;
+    } while (nameless && !tag && !decode_error.code && !at_end());
+
+    if ((!tag || at_end()) && (stream_drain(stream) || decode_error.code) &&
+        tag)
+    {
+        free_nbt_tag(tag);
+        tag = NULL;
+    }
+
+    stream_save(stream);
+    return tag;
+}
+
+// Visits the next root and the tags inside it down to the given depth,
+// with the root at depth 0. Lists of anything but compounds and lists are
+// visited as a whole. Returns 1 for each root, 0 once there are no more,
+// and -1 on error.
+int nbt_stream_walk(Nbt_stream_t *stream, size_t depth,
+                    void (*visit)(void *ctx, const Nbt_node_t *node),
+                    void *ctx)
+{
+    if (stream->done) {
+        decode_error.code = DECODE_OK;
+        return 0;
+    }
+    stream_load(stream);
+
+    int status = 0;
+    if (!stream->started || !at_end())
+        status = walk_root(depth, visit, ctx) ? 1 : -1;
+    stream->started = 1;
+
+    if ((status < 1 || at_end()) && (stream_drain(stream) || decode_error.code))
+        status = -1;
+
+    stream_save(stream);
+    return status;
+}
+
+// Seeks forward to the payload at offset, of the given type, and follows
+// the path down from there, stepping over everything off it. Returns the
+// value at the end of the path, setting type to its own. NULL without a
+// decode error means the path leads nowhere.
+Tag_t *nbt_stream_get(Nbt_stream_t *stream, size_t offset, uint8_t *type,
+                      const Path_segment_t *path, size_t count)
+{
+    stream_load(stream);
+
+    Tag_t *value = NULL;
+    if (offset < buf_offset + buf_index)
+        fail(DECODE_SEEK, "Can't seek backwards.");
+    else if (skip_bytes(offset - buf_offset - buf_index) &&
+             follow_path(type, path, count) && *type != TAG_End)
+    {
+        value = *type == TAG_Compound || *type == TAG_List
+                    ? read_tree(*type)
+                    : read_leaf(*type);
+    }
+
+    if (decode_error.code && stream_drain(stream) && value) {
+        free_functions[*type](value);
+        value = NULL;
+    }
+
+    stream_save(stream);
+    return value;
+}
+
+size_t nbt_stream_offset(const Nbt_stream_t *stream)
+{
+    return stream->offset + stream->index;
+}
+
+// Hands over the checkpoints made so far, which the caller frees
+Inflate_point_t *nbt_stream_take_points(Nbt_stream_t *stream, size_t *count)
+{
+    Inflate_point_t *points = stream->points;
+
+    *count = stream->points_length;
+    stream->points = NULL;
+    stream->points_length = stream->points_capacity = 0;
+    return points;
+}
+
+void nbt_stream_close(Nbt_stream_t *stream)
+{
+    if (!stream)
+        return;
+
+    if (stream->compressed) {
+        if (stream->threaded) {
+            pthread_mutex_lock(&stream->lock);
+            stream->cancelled = 1;
+            pthread_cond_signal(&stream->released);
+            pthread_mutex_unlock(&stream->lock);
+            pthread_join(stream->producer, NULL);
+        }
+        inflateEnd(&stream->strm);
+        for (int i = 0; i < STREAM_BUFFERS; i++)
+            free(stream->buffers[i]);
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->produced);
+        pthread_cond_destroy(&stream->released);
+    }
+    free(stream->points);
+    free(stream);
+}
+
+// A nameless root of TAG_End stands for no tag at all, and decodes to NULL
+// without an error
+Named_tag_t *read_nbt_tag()
+{
+    uint8_t type;
+    Tag_string_t *name;
+    if (!read_root(&type, &name) || type == TAG_End) return NULL;
+
+    Tag_t *tag = type == TAG_Compound || type == TAG_List ? read_tree(type)
+                                                          : read_leaf(type);
+    if (!tag) {
+        free_tag_string((Tag_t *) name);
+        return NULL;
+    }
+    return new_named_tag(type, name, tag);
 }
 
 Named_tag_t *read_TAG()
 {
     enum TAG_TYPE type = (enum TAG_TYPE) next();
     if (type == TAG_End) return NULL;
+    if (!check_type(type)) return NULL;
 
     Tag_string_t *name = (Tag_string_t *) read_TAG_String();
-
-    return new_named_tag(type, name, function_table[type]());
+    if (!name) return NULL;
+
+    Tag_t *tag = type == TAG_Compound || type == TAG_List ? read_tree(type)
+                                                          : read_leaf(type);
+    if (!tag) {
+        prepend_path((const char *) name->load, name->length);
+        prepend_path(".", 1);
+        free_tag_string((Tag_t *) name);
+        return NULL;
+    }
+    return new_named_tag(type, name, tag);
 }
 
 Tag_t *read_TAG_End()
 {
     next();
+    if (decode_error.code) return NULL;
     return new_end();
 }
 
@@ -132,48 +601,56 @@ Tag_t *read_TAG_Byte()
 {
     int8_t n;
     read_8b(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_byte(n);
 }
 
 Tag_t *read_TAG_Short()
 {
     int16_t n;
-    read_16b(&n);
+    read_short(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_short(n);
 }
 
 Tag_t *read_TAG_Int()
 {
     int32_t n;
-    read_32b(&n);
+    read_int(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_int(n);
 }
 
 Tag_t *read_TAG_Long()
 {
     int64_t n;
-    read_64b(&n);
+    read_long(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_long(n);
 }
 
 Tag_t *read_TAG_Float()
 {
     float n;
-    read_32b(&n);
+    read_float(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_float(n);
 }
 
 Tag_t *read_TAG_Double()
 {
     double n;
-    read_64b(&n);
+    read_double(&n);
+    if (decode_error.code) return NULL;
     return (Tag_t *) new_double(n);
 }
 
 Tag_t *read_TAG_Byte_Array()
 {
     int32_t length;
-    read_32b(&length);
+    read_int(&length);
+    if (decode_error.code || !check_length(length, sizeof(int8_t)))
+        return NULL;
 
     Tag_byte_array_t *tag = new_byte_array(length);
 
@@ -184,13 +661,20 @@ Tag_t *read_TAG_Byte_Array()
         tag->load[i] = n;
     }
 
+    // Lengths are only loosely bounded while inflating, so input can run out
+    if (decode_error.code) {
+        free_tag_byte_array((Tag_t *) tag);
+        return NULL;
+    }
+
     return (Tag_t *) tag;
 }
 
 Tag_t *read_TAG_String()
 {
-    int16_t length;
-    read_16b(&length);
+    int32_t length = read_string_length();
+    if (decode_error.code || !check_length(length, sizeof(int8_t)))
+        return NULL;
 
     Tag_string_t *tag = new_string(length);
 
@@ -198,75 +682,770 @@ Tag_t *read_TAG_String()
         read_8b(tag->load + i);
     }
 
+    if (decode_error.code) {
+        free_tag_string((Tag_t *) tag);
+        return NULL;
+    }
+
     return (Tag_t *) tag;
 }
 
 Tag_t *read_TAG_List()
 {
-    enum TAG_TYPE type = (enum TAG_TYPE) next();
+    return read_tree(TAG_List);
+}
+
+Tag_t *read_TAG_Compound()
+{
+    return read_tree(TAG_Compound);
+}
 
+Tag_t *read_TAG_Int_Array()
+{
     int32_t length;
-    read_32b(&length);
+    read_int(&length);
+    if (decode_error.code ||
+        !check_length(length, min_payload_size[TAG_Int]))
+        return NULL;
 
-    Tag_list_t *tag = new_list(type, length);
+    Tag_int_array_t *tag = new_int_array(length);
 
-    for (int i = 0; i < length; i++) {
-        tag->load[i] = function_table[type]();
+    // Java arrays settle the format once rather than once per element
+    if (format == NBT_JAVA) {
+        for (int i = 0; i < length; i++)
+            read_32b(tag->load + i);
+    }
+    else {
+        for (int i = 0; i < length; i++)
+            read_int(tag->load + i);
+    }
+
+    // Lengths are only loosely bounded while inflating, so input can run out
+    if (decode_error.code) {
+        free_tag_int_array((Tag_t *) tag);
+        return NULL;
     }
 
     return (Tag_t *) tag;
 }
 
-Tag_t *read_TAG_Compound()
+Tag_t *read_TAG_Long_Array()
+{
+    int32_t length;
+    read_int(&length);
+    if (decode_error.code ||
+        !check_length(length, min_payload_size[TAG_Long]))
+        return NULL;
+
+    Tag_long_array_t *tag = new_long_array(length);
+
+    if (format == NBT_JAVA) {
+        for (int i = 0; i < length; i++)
+            read_64b(tag->load + i);
+    }
+    else {
+        for (int i = 0; i < length; i++)
+            read_long(tag->load + i);
+    }
+
+    // Lengths are only loosely bounded while inflating, so input can run out
+    if (decode_error.code) {
+        free_tag_long_array((Tag_t *) tag);
+        return NULL;
+    }
+
+    return (Tag_t *) tag;
+}
+
+void nbt_decompress_end()
+{
+    if (inflater_ready)
+        inflateEnd(&inflater);
+    inflater_ready = 0;
+
+    free(frames);
+    frames = NULL;
+    frame_capacity = 0;
+
+    free(skips);
+    skips = NULL;
+    skip_capacity = 0;
+
+    free(scans);
+    scans = NULL;
+    scan_capacity = 0;
+}
+
+void nbt_set_max_depth(size_t depth)
 {
-    int length = 0;
-    Compound_node_t *tag_list = new_compound_list();
+    max_depth = depth;
+}
+
+// Applies to every thread, so it is set before any start decoding
+void nbt_set_read_format(uint8_t new_format)
+{
+    format = new_format;
+    min_payload_size = payload_sizes[format == NBT_NETWORK];
+}
+
+// Like the format, shared by every thread and set before decoding starts
+void nbt_set_read_nameless(uint8_t new_nameless)
+{
+    nameless = new_nameless;
+}
+
+uint8_t nbt_read_format()
+{
+    return format;
+}
+
+uint8_t nbt_read_nameless()
+{
+    return nameless;
+}
+
+const Decode_error_t *get_decode_error()
+{
+    return decode_error.code ? &decode_error : NULL;
+}
+
+void print_decode_error(const Decode_error_t *error)
+{
+    if (!error) return;
+
+    fprintf(stderr, _ERR "Error! " _CLEAR "%s\n" _ERR, error->message);
+    if (error->code == DECODE_INFLATE)
+        fprintf(stderr, "- at compressed byte %zu.\n" _CLEAR,
+                error->location);
+    else if (error->path[error->path_start])
+        fprintf(stderr, "- at byte %zu, in %s.\n" _CLEAR, error->location,
+                error->path + error->path_start +
+                (error->path[error->path_start] == '.'));
+    else
+        fprintf(stderr, "- at byte %zu.\n" _CLEAR, error->location);
+}
+
+// Decodes a compound or list and everything inside it in a single loop. Each
+// open container has a frame; a finished value is attached to the frame
+// below it, and an error frees the frames top-down while building the path.
+static Tag_t *read_tree(uint8_t type)
+{
+    size_t base = frame_count;
+    Tag_string_t *name = NULL;
+    Tag_t *value;
+
+    if (!open_frame(type, NULL))
+        return NULL;
+    frames[base].selective = select_paths && !base;
+    frames[base].select_length = 0;
 
     while (1) {
-        Named_tag_t *tag = read_TAG();
-        if (tag) {
-            tag_list = add_compound_node(tag_list, tag);
-            length++;
+        Decode_frame_t *frame = frames + frame_count - 1;
+        uint8_t selective = frame->selective;
+        size_t select_length = frame->select_length;
+        uint8_t closing;
+
+        if (frame->type == TAG_Compound) {
+            type = next();
+            if (decode_error.code)
+                goto failed;
+            closing = type == TAG_End;
+            if (!closing) {
+                if (!check_type(type))
+                    goto failed;
+                name = (Tag_string_t *) read_TAG_String();
+                if (!name)
+                    goto failed;
+            }
+
+            // Members off every selected path are skipped, and those on the
+            // way to one are only partly decoded
+            if (!closing && selective) {
+                int selected = select_member(frame, name, &select_length);
+                if (selected == SELECT_SOME && type != TAG_Compound &&
+                    type != TAG_List)
+                    selected = SELECT_SKIP;
+
+                if (selected == SELECT_SKIP) {
+                    if (!skip_payload(type))
+                        goto failed;
+                    free_tag_string((Tag_t *) name);
+                    name = NULL;
+                    continue;
+                }
+                selective = selected == SELECT_SOME;
+            }
         }
+        else {
+            Tag_list_t *list = frame->list;
+            closing = list->length == frame->length;
+            if (!closing && list->length == frame->capacity) {
+                frame->capacity = frame->capacity > frame->length / 2
+                                      ? frame->length
+                                      : frame->capacity * 2;
+                list->load = ast_realloc(list->load,
+                                         frame->capacity * sizeof(Tag_t *));
+            }
+            type = list->list_type;
+        }
+
+        if (closing) {
+            // A finished container becomes a value of the frame below it
+            value = close_frame(frame);
+            type = frame->type;
+            name = frame->name;
+            if (--frame_count == base)
+                return value;
+        }
+        else if (type == TAG_Compound || type == TAG_List) {
+            if (!open_frame(type, name))
+                goto failed;
+            frames[frame_count - 1].selective = selective;
+            frames[frame_count - 1].select_length = select_length;
+            name = NULL;
+            continue;
+        }
+        else if (!(value = read_leaf(type)))
+            goto failed;
+
+        frame = frames + frame_count - 1;
+        if (frame->type == TAG_Compound)
+            builder_add(&frame->members, new_named_tag(type, name, value));
         else
-            break;
+            frame->list->load[frame->list->length++] = value;
+        name = NULL;
     }
 
-    return (Tag_t *) new_compound(tag_list);
+failed:
+    // The innermost segment belongs to the member that failed to decode
+    while (frame_count > base) {
+        Decode_frame_t *frame = frames + frame_count - 1;
+
+        if (frame->type == TAG_Compound && name) {
+            prepend_path((const char *) name->load, name->length);
+            prepend_path(".", 1);
+        }
+        else if (frame->type == TAG_List)
+            prepend_index(frame->list->length);
+        if (name)
+            free_tag_string((Tag_t *) name);
+
+        name = frame->name;
+        free_functions[frame->type](close_frame(frame));
+        frame_count--;
+    }
+    return NULL;
 }
 
-Tag_t *read_TAG_Int_Array()
+static Tag_t *read_leaf(uint8_t type)
+{
+    switch (type) {
+    case TAG_End:        return read_TAG_End();
+    case TAG_Byte:       return read_TAG_Byte();
+    case TAG_Short:      return read_TAG_Short();
+    case TAG_Int:        return read_TAG_Int();
+    case TAG_Long:       return read_TAG_Long();
+    case TAG_Float:      return read_TAG_Float();
+    case TAG_Double:     return read_TAG_Double();
+    case TAG_Byte_Array: return read_TAG_Byte_Array();
+    case TAG_String:     return read_TAG_String();
+    case TAG_Int_Array:  return read_TAG_Int_Array();
+    case TAG_Long_Array: return read_TAG_Long_Array();
+    }
+    return NULL;
+}
+
+static uint8_t open_frame(uint8_t type, Tag_string_t *name)
 {
+    if (frame_count >= max_depth) {
+        fail(DECODE_TOO_DEEP, "Nesting exceeds the maximum depth.");
+        return 0;
+    }
+    if (frame_count == frame_capacity) {
+        frame_capacity = frame_capacity ? frame_capacity * 2 : FRAME_PREALLOC;
+        frames = (Decode_frame_t *) realloc(
+            frames, frame_capacity * sizeof(Decode_frame_t));
+    }
+
+    Decode_frame_t *frame = frames + frame_count;
+    frame->type = type;
+    frame->name = name;
+
+    if (type == TAG_Compound) {
+        frame->members = new_builder();
+        frame_count++;
+        return 1;
+    }
+
+    enum TAG_TYPE list_type = (enum TAG_TYPE) next();
+    if (!check_type(list_type)) return 0;
+
     int32_t length;
-    read_32b(&length);
+    read_int(&length);
+    if (decode_error.code ||
+        !check_list(list_type, length))
+        return 0;
+
+    // The element array grows as elements are actually decoded, so a forged
+    // length can't reserve more than a bounded amount up front
+    frame->length = length;
+    frame->capacity =
+        length < LIST_PREALLOC_MAX ? length : LIST_PREALLOC_MAX;
+    frame->list = new_list(list_type, frame->capacity);
+    frame->list->length = 0;
+    frame_count++;
+    return 1;
+}
 
-    Tag_int_array_t *tag = new_int_array(length);
+static Tag_t *close_frame(Decode_frame_t *frame)
+{
+    if (frame->type == TAG_Compound)
+        return (Tag_t *) new_compound(&frame->members);
+    return (Tag_t *) frame->list;
+}
 
-    for (int i = 0; i < length; i++) {
-        int32_t n;
-        read_32b(&n);
+static void prepend_index(int32_t index)
+{
+    char segment[PATH_INDEX_MAX];
+    prepend_path(segment, sprintf(segment, "[%d]", index));
+}
 
-        tag->load[i] = n;
+// Checks the member's path against the selected paths, and leaves its
+// length for the member's own frame
+static int select_member(const Decode_frame_t *frame,
+                         const Tag_string_t *name, size_t *length)
+{
+    size_t start = frame->select_length;
+    size_t end = start + (start ? 1 : 0) + name->length;
+    int selected = SELECT_SKIP;
+
+    if (end >= DECODE_PATH_MAX)
+        return SELECT_SKIP;
+    if (start)
+        select_path[start] = '.';
+    memcpy(select_path + end - name->length, name->load, name->length);
+
+    for (const char *const *path = select_paths; *path; path++) {
+        size_t path_length = strlen(*path);
+        if (path_length < end || memcmp(*path, select_path, end))
+            continue;
+        if (path_length == end)
+            return SELECT_ALL;
+        if ((*path)[end] == '.')
+            selected = SELECT_SOME;
     }
+    *length = end;
+    return selected;
+}
 
-    return (Tag_t *) tag;
+// Steps over a payload without decoding it. Nested containers are counted
+// on a stack of their own, and arrays are passed over whole.
+static uint8_t skip_payload(uint8_t type)
+{
+    size_t depth = 0;
+
+    while (1) {
+        if (!skip_value(type, &depth))
+            return 0;
+
+        while (depth) {
+            Skip_frame_t *top = skips + depth - 1;
+
+            if (top->type == TAG_Compound) {
+                type = next();
+                if (decode_error.code)
+                    return 0;
+                if (type == TAG_End) {
+                    depth--;
+                    continue;
+                }
+                if (!check_type(type))
+                    return 0;
+
+                int32_t length = read_string_length();
+                if (decode_error.code || !check_length(length, 1) ||
+                    !skip_bytes(length))
+                    return 0;
+                break;
+            }
+            if (!top->left) {
+                depth--;
+                continue;
+            }
+            top->left--;
+            type = top->list_type;
+            break;
+        }
+        if (!depth)
+            return 1;
+    }
 }
 
-Tag_t *read_TAG_Long_Array()
+static uint8_t skip_value(uint8_t type, size_t *depth)
 {
     int32_t length;
-    read_32b(&length);
+    uint8_t element;
+
+    switch (type) {
+    case TAG_End:    return skip_bytes(1);
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double: return skip_numbers(type, 1);
+    case TAG_String:
+        length = read_string_length();
+        return !decode_error.code && check_length(length, 1) &&
+               skip_bytes(length);
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+        element = type == TAG_Byte_Array  ? TAG_Byte
+                  : type == TAG_Int_Array ? TAG_Int
+                                          : TAG_Long;
+        read_int(&length);
+        return !decode_error.code &&
+               check_length(length, min_payload_size[element]) &&
+               skip_numbers(element, length);
+    }
 
-    Tag_long_array_t *tag = new_long_array(length);
+    if (frame_count + *depth >= max_depth) {
+        fail(DECODE_TOO_DEEP, "Nesting exceeds the maximum depth.");
+        return 0;
+    }
+    if (*depth == skip_capacity) {
+        skip_capacity = skip_capacity ? skip_capacity * 2 : FRAME_PREALLOC;
+        skips = (Skip_frame_t *) realloc(skips,
+                                         skip_capacity * sizeof(Skip_frame_t));
+    }
 
-    for (int i = 0; i < length; i++) {
-        int64_t n;
-        read_64b(&n);
+    Skip_frame_t *frame = skips + (*depth)++;
+    frame->type = type;
+    if (type == TAG_Compound)
+        return 1;
+
+    frame->list_type = next();
+    if (!check_type(frame->list_type))
+        return 0;
+    read_int(&length);
+    if (decode_error.code ||
+        !check_list(frame->list_type, length))
+        return 0;
+    frame->left = length;
+
+    // Lists of numbers are stepped over in one go
+    if (frame->list_type >= TAG_Byte && frame->list_type <= TAG_Double) {
+        (*depth)--;
+        return skip_numbers(frame->list_type, length);
+    }
+    return 1;
+}
 
-        tag->load[i] = n;
+static uint8_t skip_bytes(size_t count)
+{
+    while (buf_len - buf_index < count) {
+        count -= buf_len - buf_index;
+        buf_index = buf_len;
+        if (!refill()) {
+            fail(DECODE_EOF, "Unexpected EOF.");
+            return 0;
+        }
     }
+    buf_index += count;
+    return 1;
+}
 
-    return (Tag_t *) tag;
+// Numbers of a fixed size are stepped over in one go, and varints a byte at
+// a time
+static uint8_t skip_numbers(uint8_t type, size_t count)
+{
+    if (format != NBT_NETWORK || (type != TAG_Int && type != TAG_Long))
+        return skip_bytes(count * min_payload_size[type]);
+
+    for (size_t i = 0; i < count; i++) {
+        read_varint(type == TAG_Int ? VARINT_MAX_32 : VARINT_MAX_64);
+        if (decode_error.code)
+            return 0;
+    }
+    return 1;
+}
+
+static uint8_t walk_root(size_t depth,
+                         void (*visit)(void *ctx, const Nbt_node_t *node),
+                         void *ctx)
+{
+    Nbt_node_t node;
+    Tag_string_t *root_name;
+    size_t count = 0;
+
+    if (!read_root(&node.type, &root_name))
+        return 0;
+    if (node.type == TAG_End)
+        return 1;
+
+    while (1) {
+        Skip_frame_t *top = count ? scans + count - 1 : NULL;
+
+        node.name = NULL;
+        node.index = -1;
+        node.depth = count;
+        if (!top)
+            node.name = root_name;
+        else if (top->type == TAG_Compound) {
+            node.type = next();
+            if (decode_error.code)
+                return 0;
+            if (node.type == TAG_End) {
+                if (!--count)
+                    return 1;
+                continue;
+            }
+            if (!check_type(node.type) ||
+                !(node.name = (Tag_string_t *) read_TAG_String()))
+                return 0;
+        }
+        else {
+            if (!top->left) {
+                if (!--count)
+                    return 1;
+                continue;
+            }
+            node.type = top->list_type;
+            node.index = top->length - top->left--;
+        }
+
+        node.offset = buf_offset + buf_index;
+        visit(ctx, &node);
+        if (node.name)
+            free_tag_string((Tag_t *) node.name);
+
+        uint8_t container = node.type == TAG_Compound ||
+                            node.type == TAG_List;
+        if (!container || count >= depth) {
+            if (!skip_payload(node.type))
+                return 0;
+            if (!count)
+                return 1;
+        }
+        else if (!push_scan(node.type, count++))
+            return 0;
+    }
+}
+
+// Opens a container to walk, unless it is a list of values, which is
+// stepped over instead
+static uint8_t push_scan(uint8_t type, size_t depth)
+{
+    if (frame_count + depth >= max_depth) {
+        fail(DECODE_TOO_DEEP, "Nesting exceeds the maximum depth.");
+        return 0;
+    }
+    if (depth == scan_capacity) {
+        scan_capacity = scan_capacity ? scan_capacity * 2 : FRAME_PREALLOC;
+        scans = (Skip_frame_t *) realloc(scans,
+                                         scan_capacity * sizeof(Skip_frame_t));
+    }
+
+    Skip_frame_t *frame = scans + depth;
+    frame->type = type;
+    if (type == TAG_Compound)
+        return 1;
+
+    int32_t length;
+    frame->list_type = next();
+    if (!check_type(frame->list_type))
+        return 0;
+    read_int(&length);
+    if (decode_error.code ||
+        !check_list(frame->list_type, length))
+        return 0;
+    frame->length = frame->left = length;
+
+    if (frame->list_type != TAG_Compound && frame->list_type != TAG_List) {
+        frame->left = 0;
+        return skip_elements(frame->list_type, length);
+    }
+    return 1;
+}
+
+// Steps along the path from the payload the decoder is at. Returns 0 on
+// error, or with type set to TAG_End if the path leads nowhere.
+static uint8_t follow_path(uint8_t *type, const Path_segment_t *path,
+                           size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        const Path_segment_t *segment = path + i;
+
+        if (segment->name && *type == TAG_Compound) {
+            while (1) {
+                uint8_t member = next();
+                if (decode_error.code)
+                    return 0;
+                if (member == TAG_End) {
+                    *type = TAG_End;
+                    return 1;
+                }
+                Tag_string_t *name;
+                if (!check_type(member) ||
+                    !(name = (Tag_string_t *) read_TAG_String()))
+                    return 0;
+
+                uint8_t found =
+                    (size_t) name->length == segment->length &&
+                    !memcmp(name->load, segment->name, segment->length);
+                free_tag_string((Tag_t *) name);
+                if (found) {
+                    *type = member;
+                    break;
+                }
+                if (!skip_payload(member))
+                    return 0;
+            }
+        }
+        else if (!segment->name && *type == TAG_List) {
+            uint8_t list_type = next();
+            int32_t length;
+            if (!check_type(list_type))
+                return 0;
+            read_int(&length);
+            if (decode_error.code ||
+                !check_list(list_type, length))
+                return 0;
+            if (segment->index < 0 || segment->index >= length) {
+                *type = TAG_End;
+                return 1;
+            }
+            if (!skip_elements(list_type, segment->index))
+                return 0;
+            *type = list_type;
+        }
+        else {
+            *type = TAG_End;
+            return 1;
+        }
+    }
+    return 1;
+}
+
+static uint8_t skip_elements(uint8_t type, int32_t count)
+{
+    if (type >= TAG_Byte && type <= TAG_Double)
+        return skip_numbers(type, count);
+    for (int32_t i = 0; i < count; i++) {
+        if (!skip_payload(type))
+            return 0;
+    }
+    return 1;
+}
+
+// Nameless roots, as the network protocol sends them, may be of any type.
+// Named ones are always compounds.
+static uint8_t read_root(uint8_t *type, Tag_string_t **name)
+{
+    *type = next();
+    *name = NULL;
+    if (decode_error.code)
+        return 0;
+
+    if (nameless) {
+        if (!check_type(*type))
+            return 0;
+        if (*type != TAG_End)
+            *name = new_string(0);
+        return 1;
+    }
+    if (*type != TAG_Compound) {
+        buf_index--;
+        fail(DECODE_INVALID_ROOT, "Root tag is not compound.");
+        return 0;
+    }
+    *name = (Tag_string_t *) read_TAG_String();
+    return *name != NULL;
+}
+
+static void fail(int code, const char *message)
+{
+    if (decode_error.code) return;
+    decode_error.code = code;
+    decode_error.message = message;
+    if (code != DECODE_INFLATE)
+        decode_error.location = buf_offset + buf_index;
+    decode_error.path_start = DECODE_PATH_MAX - 1;
+    decode_error.path[decode_error.path_start] = 0x00;
+}
+
+static void prepend_path(const char *segment, size_t length)
+{
+    // The path is assembled back to front while the readers unwind, and
+    // only the innermost part is kept if it doesn't fit
+    if (length > decode_error.path_start) {
+        decode_error.path_start = 0;
+        return;
+    }
+    decode_error.path_start -= length;
+    memcpy(decode_error.path + decode_error.path_start, segment, length);
+}
+
+static uint8_t check_type(uint8_t type)
+{
+    if (decode_error.code) return 0;
+    if (type > TAG_Long_Array) {
+        buf_index--;
+        fail(DECODE_INVALID_TYPE, "Invalid tag type.");
+        return 0;
+    }
+    return 1;
+}
+
+static uint8_t check_length(int64_t length, size_t element_size)
+{
+    if (length < 0) {
+        fail(DECODE_INVALID_LENGTH, "Negative length.");
+        return 0;
+    }
+    // While inflating, the rest of the document is bounded by what the rest of
+    // the compressed input can expand to
+    size_t remaining = buf_len - buf_index;
+    if (active_stream && active_stream->compressed) {
+        size_t left = active_stream->data_length -
+                      atomic_load_explicit(&active_stream->consumed,
+                                           memory_order_relaxed);
+        remaining += left > SIZE_MAX / DEFLATE_MAX_RATIO
+                         ? SIZE_MAX / 2
+                         : left * DEFLATE_MAX_RATIO + STREAM_SLACK;
+    }
+    if ((uint64_t) length > remaining / element_size) {
+        fail(DECODE_INVALID_LENGTH, "Length exceeds the remaining input.");
+        return 0;
+    }
+    return 1;
+}
+
+// A list of TAG_End has no payloads to read, so only an empty one is valid
+static uint8_t check_list(uint8_t list_type, int32_t length)
+{
+    if (list_type == TAG_End && length > 0) {
+        fail(DECODE_INVALID_LENGTH, "List of TAG_End is not empty.");
+        return 0;
+    }
+    return check_length(length, min_payload_size[list_type]);
+}
+
+static size_t gzip_isize(const uint8_t *data, size_t length)
+{
+    if (length < GZIP_MIN_SIZE || data[0] != GZIP_MAGIC_0)
+        return 0;
+
+    // The trailer holds the size modulo 2^32 of the last member only, so it
+    // is just a hint, and implausible values are ignored
+    const uint8_t *trailer = data + length - 4;
+    size_t isize = (size_t) trailer[0] | (size_t) trailer[1] << 8 |
+                   (size_t) trailer[2] << 16 | (size_t) trailer[3] << 24;
+
+    if (isize / DEFLATE_MAX_RATIO > length)
+        return 0;
+    return isize;
 }
 
 static void read_8b(void *ptr)
@@ -275,11 +1454,12 @@ static void read_8b(void *ptr)
     *(uint8_t *) ptr = r;
 }
 
+// Copied rather than stored through a cast, as floats are read this way too
 static void read_16b(void *ptr)
 {
     uint16_t r = (uint8_t) next();
     r = r << 8 | (uint8_t) next();
-    *(uint16_t *) ptr = r;
+    memcpy(ptr, &r, sizeof(r));
 }
 
 static void read_32b(void *ptr)
@@ -288,7 +1468,7 @@ static void read_32b(void *ptr)
     r = r << 8 | (uint8_t) next();
     r = r << 8 | (uint8_t) next();
     r = r << 8 | (uint8_t) next();
-    *(uint32_t *) ptr = r;
+    memcpy(ptr, &r, sizeof(r));
 }
 
 static void read_64b(void *ptr)
@@ -301,14 +1481,372 @@ static void read_64b(void *ptr)
     r = r << 8 | (uint8_t) next();
     r = r << 8 | (uint8_t) next();
     r = r << 8 | (uint8_t) next();
-    *(uint64_t *) ptr = r;
+    memcpy(ptr, &r, sizeof(r));
+}
+
+static void read_16l(void *ptr)
+{
+    uint16_t r = (uint8_t) next();
+    r |= (uint16_t) (uint8_t) next() << 8;
+    memcpy(ptr, &r, sizeof(r));
+}
+
+static void read_32l(void *ptr)
+{
+    uint32_t r = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        r |= (uint32_t) (uint8_t) next() << shift;
+    memcpy(ptr, &r, sizeof(r));
+}
+
+static void read_64l(void *ptr)
+{
+    uint64_t r = 0;
+    for (int shift = 0; shift < 64; shift += 8)
+        r |= (uint64_t) (uint8_t) next() << shift;
+    memcpy(ptr, &r, sizeof(r));
+}
+
+// Seven bits a byte, lowest first, for as long as the top bit is set
+static uint64_t read_varint(size_t max_bytes)
+{
+    uint64_t r = 0;
+
+    for (size_t shift = 0; shift < max_bytes * 7; shift += 7) {
+        uint8_t byte = next();
+        r |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return r;
+    }
+    fail(DECODE_INVALID_VARINT, "Varint is too long.");
+    return 0;
+}
+
+// Numbers in the order of the format. Java's comes first, so its readers
+// are only a well-predicted branch away.
+static void read_short(void *ptr)
+{
+    if (format == NBT_JAVA)
+        read_16b(ptr);
+    else
+        read_16l(ptr);
+}
+
+// The network format zigzags ints and longs, so small negative numbers make
+// short varints too
+static void read_int(void *ptr)
+{
+    if (format == NBT_JAVA)
+        read_32b(ptr);
+    else if (format == NBT_BEDROCK)
+        read_32l(ptr);
+    else {
+        uint32_t r = read_varint(VARINT_MAX_32);
+        int32_t n = (int32_t) (r >> 1) ^ -(int32_t) (r & 1);
+        memcpy(ptr, &n, sizeof(n));
+    }
+}
+
+static void read_long(void *ptr)
+{
+    if (format == NBT_JAVA)
+        read_64b(ptr);
+    else if (format == NBT_BEDROCK)
+        read_64l(ptr);
+    else {
+        uint64_t r = read_varint(VARINT_MAX_64);
+        int64_t n = (int64_t) (r >> 1) ^ -(int64_t) (r & 1);
+        memcpy(ptr, &n, sizeof(n));
+    }
+}
+
+static void read_float(void *ptr)
+{
+    if (format == NBT_JAVA)
+        read_32b(ptr);
+    else
+        read_32l(ptr);
+}
+
+static void read_double(void *ptr)
+{
+    if (format == NBT_JAVA)
+        read_64b(ptr);
+    else
+        read_64l(ptr);
+}
+
+// Strings are at most UINT16_MAX bytes however their length is written, and
+// the network format writes it as a plain varint
+static int32_t read_string_length()
+{
+    uint16_t length;
+
+    if (format == NBT_NETWORK) {
+        uint64_t r = read_varint(VARINT_MAX_32);
+        if (r > UINT16_MAX) {
+            fail(DECODE_INVALID_LENGTH, "String is too long.");
+            return 0;
+        }
+        return (int32_t) r;
+    }
+    read_short(&length);
+    return length;
 }
 
 static uint8_t next()
 {
-    if (buf_index >= buf_len) {
-        fprintf(stderr, _ERR "ERROR! Unexpected EOF.\n" _CLEAR);
-        exit(1);
+    if (buf_index >= buf_len && !refill()) {
+        fail(DECODE_EOF, "Unexpected EOF.");
+        return 0;
     }
     return out_buf[buf_index++];
 }
+
+static uint8_t is_gzip_member(const uint8_t *data, size_t length)
+{
+    return length >= 2 && data[0] == GZIP_MAGIC_0 && data[1] == GZIP_MAGIC_1;
+}
+
+// Fills out with up to capacity inflated bytes. Returns Z_OK while more of
+// the stream is to come. Concatenated gzip members inflate as one stream.
+static int inflate_into(Nbt_stream_t *stream, uint8_t *out, size_t capacity,
+                        size_t *filled)
+{
+    z_streamp strmp = &stream->strm;
+    int status = Z_OK;
+
+    *filled = 0;
+    while (*filled < capacity) {
+        if (!strmp->avail_in) {
+            strmp->next_in = (uint8_t *) stream->data + stream->fed;
+            strmp->avail_in = ZLIB_AVAIL(stream->data_length - stream->fed);
+            stream->fed += strmp->avail_in;
+        }
+        strmp->next_out = out + *filled;
+        strmp->avail_out = capacity - *filled;
+
+        // Making checkpoints stops inflate at every block boundary
+        status = inflate(strmp, stream->span ? Z_BLOCK : Z_NO_FLUSH);
+        stream->inflated += capacity - strmp->avail_out - *filled;
+        *filled = capacity - strmp->avail_out;
+
+        size_t used = stream->fed - strmp->avail_in;
+        atomic_store_explicit(&stream->consumed, used, memory_order_relaxed);
+
+        if (status == Z_OK && stream->span &&
+            (strmp->data_type & 0xC0) == 0x80)
+            add_point(stream, used);
+
+        // Raw deflate leaves the trailer of its member to be stepped over
+        if (status == Z_STREAM_END && stream->raw) {
+            used = used + stream->trailer < stream->data_length
+                       ? used + stream->trailer
+                       : stream->data_length;
+            stream->fed = used;
+            strmp->avail_in = 0;
+            stream->raw = 0;
+            inflateReset2(strmp, windowBits | ENABLE_ZLIB_GZIP);
+        }
+        if (status == Z_STREAM_END &&
+            is_gzip_member(stream->data + used, stream->data_length - used)) {
+            inflateReset(strmp);
+            stream->trailer = 8;
+            status = Z_OK;
+            continue;
+        }
+        if (status == Z_OK ||
+            (status == Z_BUF_ERROR && stream->fed < stream->data_length))
+            continue;
+        break;
+    }
+
+    if (status != Z_OK && status != Z_STREAM_END) {
+        stream->error_location = stream->fed - strmp->avail_in;
+        if (status == Z_BUF_ERROR)
+            stream->message = "Truncated compressed input.";
+        else
+            stream->message =
+                strmp->msg ? strmp->msg : "Corrupt compressed input.";
+    }
+    return status;
+}
+
+// Checkpoints go at the first block boundary at least span bytes of output
+// on from the last, with the window inflating it needs
+static void add_point(Nbt_stream_t *stream, size_t used)
+{
+    z_streamp strmp = &stream->strm;
+    size_t last = stream->points_length
+                      ? stream->points[stream->points_length - 1].out
+                      : 0;
+
+    if (stream->inflated - last < stream->span)
+        return;
+
+    if (stream->points_length == stream->points_capacity) {
+        stream->points_capacity = stream->points_capacity
+                                      ? stream->points_capacity * 2
+                                      : POINT_PREALLOC;
+        stream->points = (Inflate_point_t *) realloc(
+            stream->points, stream->points_capacity * sizeof(Inflate_point_t));
+    }
+
+    Inflate_point_t *point = stream->points + stream->points_length;
+    uInt length = INFLATE_WINDOW;
+    if (inflateGetDictionary(strmp, point->window, &length))
+        return;
+
+    point->in = used;
+    point->out = stream->inflated;
+    point->window_length = length;
+    point->bits = strmp->data_type & 7;
+    point->trailer = stream->trailer;
+    stream->points_length++;
+}
+
+static void *inflate_producer(void *arg)
+{
+    Nbt_stream_t *stream = (Nbt_stream_t *) arg;
+
+    for (size_t slot = 0;; slot = (slot + 1) % STREAM_BUFFERS) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->ready[slot] && !stream->cancelled)
+            pthread_cond_wait(&stream->released, &stream->lock);
+        uint8_t cancelled = stream->cancelled;
+        pthread_mutex_unlock(&stream->lock);
+        if (cancelled)
+            return NULL;
+
+        size_t filled;
+        int status = inflate_into(stream, stream->buffers[slot],
+                                  STREAM_BUFFER, &filled);
+        publish(stream, slot, filled, status);
+        if (status != Z_OK)
+            return NULL;
+    }
+}
+
+// Hands a filled buffer to the decoder. Anything but Z_OK ends the stream.
+static void publish(Nbt_stream_t *stream, size_t slot, size_t filled,
+                    int status)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->filled[slot] = filled;
+    stream->ready[slot] = 1;
+    if (status != Z_OK) {
+        stream->finished = 1;
+        stream->status = status;
+    }
+    pthread_cond_signal(&stream->produced);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Moves the decoder on to the next inflated buffer, if there is one
+static uint8_t refill()
+{
+    Nbt_stream_t *stream = active_stream;
+
+    if (!stream || !stream->compressed)
+        return 0;
+
+    buf_offset += buf_len;
+    buf_index = buf_len = 0;
+
+    if (!stream->threaded) {
+        out_buf = stream->buffers[0];
+        while (stream->status == Z_OK && !buf_len)
+            stream->status = inflate_into(stream, stream->buffers[0],
+                                          STREAM_BUFFER, &buf_len);
+        return buf_len > 0;
+    }
+
+    // The buffer just read goes back to the producer
+    pthread_mutex_lock(&stream->lock);
+    if (out_buf) {
+        size_t last = (stream->next_slot + STREAM_BUFFERS - 1) %
+                      STREAM_BUFFERS;
+        stream->ready[last] = 0;
+        out_buf = NULL;
+        pthread_cond_signal(&stream->released);
+    }
+    while (!buf_len) {
+        size_t slot = stream->next_slot;
+        while (!stream->ready[slot] && !stream->finished)
+            pthread_cond_wait(&stream->produced, &stream->lock);
+        if (!stream->ready[slot])
+            break;
+
+        stream->next_slot = (slot + 1) % STREAM_BUFFERS;
+        buf_len = stream->filled[slot];
+        if (buf_len)
+            out_buf = stream->buffers[slot];
+        else {
+            stream->ready[slot] = 0;
+            pthread_cond_signal(&stream->released);
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return buf_len > 0;
+}
+
+// Trailing zeros pad some files out, and end a stream like its end does.
+// Anything else after them is an error, which also ends the stream. Nameless
+// roots may be TAG_End themselves, so there a zero is just another root.
+static uint8_t at_end()
+{
+    if (buf_index >= buf_len && !refill())
+        return 1;
+    if (nameless || out_buf[buf_index] != TAG_End)
+        return 0;
+
+    do {
+        for (; buf_index < buf_len; buf_index++) {
+            if (out_buf[buf_index]) {
+                fail(DECODE_TRAILING_DATA, "Trailing data after root.");
+                return 1;
+            }
+        }
+    } while (refill());
+    return 1;
+}
+
+// The decoder's position lives in thread-locals while a stream is in use
+static void stream_load(Nbt_stream_t *stream)
+{
+    decode_error.code = DECODE_OK;
+    decode_error.path_start = DECODE_PATH_MAX - 1;
+    decode_error.path[decode_error.path_start] = 0x00;
+
+    active_stream = stream;
+    out_buf = stream->window;
+    buf_index = stream->index;
+    buf_len = stream->length;
+    buf_offset = stream->offset;
+}
+
+static void stream_save(Nbt_stream_t *stream)
+{
+    stream->window = out_buf;
+    stream->index = buf_index;
+    stream->length = buf_len;
+    stream->offset = buf_offset;
+    active_stream = NULL;
+}
+
+// Inflates and checks whatever is left. Returns 1 if inflating failed, which
+// then replaces any decode error.
+static uint8_t stream_drain(Nbt_stream_t *stream)
+{
+    stream->done = 1;
+    while (refill())
+        ;
+    if (!stream->compressed || stream->status == Z_STREAM_END)
+        return 0;
+
+    decode_error.code = DECODE_OK;
+    decode_error.location = stream->error_location;
+    fail(DECODE_INFLATE, stream->message);
+    return 1;
+}
@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <ast.h>
+#include <decompress.h>
+#include <index.h>
+#include <input.h>
+#include <print.h>
+
+//// MACROS ////
+
+#define INDEX_NODES_PREALLOC 0x100
+#define INDEX_NAMES_PREALLOC 0x1000
+#define INDEX_PATH_PREALLOC  8
+
+//// DECLARATIONS ////
+
+static void make_key(Index_header_t *key, const char *path,
+                     const Input_t *input);
+static char *sidecar_path(const char *path, const char *extension);
+static int load(Index_t *index, const char *index_path,
+                const Index_header_t *key);
+static void save(const Index_t *index, const char *index_path);
+static void link_nodes(Index_t *index);
+static void add_node(void *ctx, const Nbt_node_t *node);
+static uint32_t find_child(const Index_t *index, uint32_t node,
+                           const Path_segment_t *segment);
+static const Inflate_point_t *find_point(const Index_t *index,
+                                         uint64_t offset);
+static int path_error(Index_path_t *lookup, const char *text);
+
+//// DEFINITIONS ////
+
+// Reuses the index next to the file if the file hasn't changed since it was
+// made, and otherwise walks the file once to make it again. Standard input
+// is indexed in memory only.
+int index_open(Index_t *index, const char *path, const Input_t *input)
+{
+    Index_header_t key;
+    char *index_path = path ? sidecar_path(path, INDEX_EXTENSION) : NULL;
+
+    memset(index, 0, sizeof(Index_t));
+    make_key(&key, path, input);
+
+    if (index_path && !load(index, index_path, &key)) {
+        link_nodes(index);
+        free(index_path);
+        return 0;
+    }
+
+    Nbt_stream_t *stream = nbt_stream_open_points(input->data, input->length,
+                                                  1, key.span);
+    int status = stream ? 1 : -1;
+    while (status > 0)
+        status = nbt_stream_walk(stream, INDEX_DEPTH, add_node, index);
+    if (stream) {
+        size_t points;
+        index->points = nbt_stream_take_points(stream, &points);
+        key.points = points;
+    }
+    nbt_stream_close(stream);
+
+    if (status) {
+        index_close(index);
+        free(index_path);
+        return -1;
+    }
+
+    if (!index->names)
+        index->names = (char *) malloc(1);
+    key.nodes = index->header.nodes;
+    key.names_length = index->header.names_length;
+    index->header = key;
+    if (index_path)
+        save(index, index_path);
+
+    link_nodes(index);
+    free(index_path);
+    return 0;
+}
+
+// Goes down the index as far as it reaches, and from that node's payload
+// on steps over the bytes to the end of the path. Without an error, out is
+// NULL if the root has nothing there.
+int index_get(const Index_t *index, const Input_t *input,
+              const Index_path_t *lookup, size_t root, Named_tag_t **out)
+{
+    uint32_t node = index->roots[root];
+    size_t depth = 0;
+
+    *out = NULL;
+    while (depth < lookup->length && index->children[node] != INDEX_NONE) {
+        node = find_child(index, node, lookup->segments + depth);
+        if (node == INDEX_NONE)
+            return 0;
+        depth++;
+    }
+
+    // Inflating resumes from the last checkpoint before the node
+    const Index_node_t *found = index->nodes + node;
+    const Inflate_point_t *point = find_point(index, found->offset);
+    uint8_t type = found->type;
+    Nbt_stream_t *stream =
+        point ? nbt_stream_resume(input->data, input->length, point)
+              : nbt_stream_open(input->data, input->length, 1);
+    if (!stream)
+        return -1;
+
+    Tag_t *tag = nbt_stream_get(stream, found->offset, &type,
+                                lookup->segments + depth,
+                                lookup->length - depth);
+    nbt_stream_close(stream);
+    if (!tag)
+        return get_decode_error() ? -1 : 0;
+
+    *out = index_result(lookup, index->names + found->name,
+                        found->name_length, type, tag);
+    return 0;
+}
+
+// Names the value found after the last member on the path, or after the
+// root for an empty path. Anything but a compound goes in an unnamed root,
+// so it can be written out like any other file.
+Named_tag_t *index_result(const Index_path_t *lookup, const char *root_name,
+                          size_t root_length, uint8_t type, Tag_t *tag)
+{
+    const char *name = "";
+    size_t length = 0;
+
+    if (lookup->length && lookup->segments[lookup->length - 1].name) {
+        name = lookup->segments[lookup->length - 1].name;
+        length = lookup->segments[lookup->length - 1].length;
+    }
+    else if (!lookup->length) {
+        name = root_name;
+        length = root_length;
+    }
+
+    Tag_string_t *string = new_string(length);
+    memcpy(string->load, name, length);
+    Named_tag_t *result = new_named_tag(type, string, tag);
+
+    if (type != TAG_Compound) {
+        Builder_t builder = new_builder();
+        builder_add(&builder, result);
+        result = new_named_tag(TAG_Compound, new_string(0),
+                               (Tag_t *) new_compound(&builder));
+    }
+    return result;
+}
+
+void index_close(Index_t *index)
+{
+    free(index->nodes);
+    free(index->names);
+    free(index->children);
+    free(index->siblings);
+    free(index->roots);
+    free(index->points);
+    memset(index, 0, sizeof(Index_t));
+}
+
+// Paths name members with dots and list elements with brackets, as in
+// Data.Player.Inventory[0].id. Names with either in them go in quotes.
+int index_parse_path(Index_path_t *lookup, const char *text)
+{
+    size_t capacity = 0;
+    char *names = (char *) malloc(strlen(text) + 1);
+    const char *c = text;
+
+    lookup->segments = NULL;
+    lookup->length = 0;
+    lookup->names = names;
+    if (!*c)
+        return 0;
+
+    while (1) {
+        if (lookup->length == capacity) {
+            capacity = capacity ? capacity * 2 : INDEX_PATH_PREALLOC;
+            lookup->segments = (Path_segment_t *) realloc(
+                lookup->segments, capacity * sizeof(Path_segment_t));
+        }
+        Path_segment_t *segment = lookup->segments + lookup->length++;
+
+        if (*c == '[') {
+            char *end;
+            long index = strtol(c + 1, &end, 10);
+            if (end == c + 1 || *end != ']' || index < 0 ||
+                index > INT32_MAX || c[1] == '-' || c[1] == '+')
+                return path_error(lookup, text);
+            segment->name = NULL;
+            segment->length = 0;
+            segment->index = (int32_t) index;
+            c = end + 1;
+        }
+        else {
+            segment->name = names;
+            segment->index = -1;
+            if (*c == '"') {
+                for (c++; *c && *c != '"'; c++) {
+                    if (*c == '\\' && (c[1] == '"' || c[1] == '\\'))
+                        c++;
+                    *names++ = *c;
+                }
+                if (*c++ != '"')
+                    return path_error(lookup, text);
+            }
+            else {
+                for (; *c && *c != '.' && *c != '['; c++)
+                    *names++ = *c;
+                if (names == segment->name)
+                    return path_error(lookup, text);
+            }
+            segment->length = names - segment->name;
+        }
+
+        if (!*c)
+            return 0;
+        if (*c == '.' && c[1] && c[1] != '.' && c[1] != '[')
+            c++;
+        else if (*c != '[')
+            return path_error(lookup, text);
+    }
+}
+
+void index_free_path(Index_path_t *lookup)
+{
+    free(lookup->segments);
+    free(lookup->names);
+    lookup->segments = NULL;
+    lookup->names = NULL;
+    lookup->length = 0;
+}
+
+// The index is trusted only for the same size, modification time and
+// bytes at either end
+static void make_key(Index_header_t *key, const char *path,
+                     const Input_t *input)
+{
+    struct stat st;
+    size_t span = input->length < INDEX_HASH_SPAN ? input->length
+                                                  : INDEX_HASH_SPAN;
+    uLong hash = crc32(0, input->data, span);
+
+    memset(key, 0, sizeof(Index_header_t));
+    memcpy(key->magic, INDEX_MAGIC, sizeof(key->magic));
+    key->version = INDEX_VERSION;
+    key->size = input->length;
+    key->hash = crc32(hash, input->data + input->length - span, span);
+    key->depth = INDEX_DEPTH;
+    key->format = nbt_read_format();
+    key->nameless = nbt_read_nameless();
+    key->span = INFLATE_SPAN;
+    if (path && !stat(path, &st)) {
+        key->mtime = st.st_mtim.tv_sec;
+        key->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+}
+
+static char *sidecar_path(const char *path, const char *extension)
+{
+    size_t length = strlen(path) + strlen(extension) + 1;
+    char *sidecar = (char *) malloc(length);
+    snprintf(sidecar, length, "%s%s", path, extension);
+    return sidecar;
+}
+
+// Anything that doesn't match the key or doesn't add up is ignored, and
+// the index is made again
+static int load(Index_t *index, const char *index_path,
+                const Index_header_t *key)
+{
+    Index_header_t header;
+    struct stat st;
+    FILE *file = fopen(index_path, "rb");
+    int status = -1;
+
+    if (!file)
+        return -1;
+    if (fstat(fileno(file), &st) ||
+        fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, key->magic, sizeof(header.magic)) ||
+        header.version != key->version || header.size != key->size ||
+        header.mtime != key->mtime || header.mtime_nsec != key->mtime_nsec ||
+        header.hash != key->hash || header.depth != key->depth ||
+        header.format != key->format || header.nameless != key->nameless ||
+        header.span != key->span || (!header.nodes && !header.nameless) ||
+        header.nodes > (uint64_t) st.st_size / sizeof(Index_node_t) ||
+        header.points > (uint64_t) st.st_size / sizeof(Inflate_point_t) ||
+        (uint64_t) st.st_size !=
+            sizeof(header) + header.nodes * sizeof(Index_node_t) +
+                header.names_length + header.points * sizeof(Inflate_point_t))
+    {
+        fclose(file);
+        return -1;
+    }
+
+    index->header = header;
+    index->nodes = (Index_node_t *) malloc(
+        (header.nodes ? header.nodes : 1) * sizeof(Index_node_t));
+    index->names = (char *) malloc(header.names_length + 1);
+    index->points = (Inflate_point_t *) malloc(
+        (header.points ? header.points : 1) * sizeof(Inflate_point_t));
+
+    if ((!header.nodes ||
+         fread(index->nodes, sizeof(Index_node_t), header.nodes, file) ==
+             header.nodes) &&
+        (!header.names_length ||
+         fread(index->names, header.names_length, 1, file) == 1) &&
+        (!header.points ||
+         fread(index->points, sizeof(Inflate_point_t), header.points,
+               file) == header.points))
+    {
+        status = 0;
+        for (uint64_t i = 0; i < header.nodes && !status; i++) {
+            Index_node_t *node = index->nodes + i;
+            if ((node->parent != INDEX_NONE && node->parent >= i) ||
+                (node->parent == INDEX_NONE && !header.nameless &&
+                 node->type != TAG_Compound) ||
+                node->type > TAG_Long_Array ||
+                (node->named &&
+                 (node->name > header.names_length ||
+                  node->name_length > header.names_length - node->name)))
+                status = -1;
+        }
+        for (uint64_t i = 0; i < header.points && !status; i++) {
+            Inflate_point_t *point = index->points + i;
+            if (point->in > header.size ||
+                (i && point->out <= point[-1].out))
+                status = -1;
+        }
+    }
+    fclose(file);
+
+    if (status)
+        index_close(index);
+    return status;
+}
+
+// A missing index only costs time, so failing to save one is a warning
+static void save(const Index_t *index, const char *index_path)
+{
+    char *temp = sidecar_path(index_path, ".tmp");
+    FILE *file = fopen(temp, "wb");
+    int status = file ? 0 : -1;
+
+    if (file) {
+        const Index_header_t *header = &index->header;
+        if (fwrite(header, sizeof(*header), 1, file) != 1 ||
+            (header->nodes &&
+             fwrite(index->nodes, sizeof(Index_node_t), header->nodes,
+                    file) != header->nodes) ||
+            (header->names_length &&
+             fwrite(index->names, header->names_length, 1, file) != 1) ||
+            (header->points &&
+             fwrite(index->points, sizeof(Inflate_point_t), header->points,
+                    file) != header->points))
+            status = -1;
+        if (fclose(file))
+            status = -1;
+    }
+    if (!status && rename(temp, index_path))
+        status = -1;
+
+    if (status) {
+        fprintf(stderr,
+                _INFO "Warning! Can't save the index \"%s\": %s.\n" _CLEAR,
+                index_path, strerror(errno));
+        unlink(temp);
+    }
+    free(temp);
+}
+
+// Children are chained in document order, from the back
+static void link_nodes(Index_t *index)
+{
+    size_t count = index->header.nodes;
+
+    index->children = (uint32_t *) malloc(count * sizeof(uint32_t));
+    index->siblings = (uint32_t *) malloc(count * sizeof(uint32_t));
+    index->roots = (uint32_t *) malloc(count * sizeof(uint32_t));
+    index->roots_length = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        index->children[i] = INDEX_NONE;
+        if (index->nodes[i].parent == INDEX_NONE)
+            index->roots[index->roots_length++] = i;
+    }
+    for (size_t i = count; i-- > 0;) {
+        uint32_t parent = index->nodes[i].parent;
+        index->siblings[i] = INDEX_NONE;
+        if (parent != INDEX_NONE) {
+            index->siblings[i] = index->children[parent];
+            index->children[parent] = i;
+        }
+    }
+}
+
+static void add_node(void *ctx, const Nbt_node_t *node)
+{
+    Index_t *index = (Index_t *) ctx;
+    Index_header_t *header = &index->header;
+
+    if (header->nodes == index->nodes_capacity) {
+        index->nodes_capacity = index->nodes_capacity
+                                    ? index->nodes_capacity * 2
+                                    : INDEX_NODES_PREALLOC;
+        index->nodes = (Index_node_t *) realloc(
+            index->nodes, index->nodes_capacity * sizeof(Index_node_t));
+    }
+
+    Index_node_t *added = index->nodes + header->nodes;
+    memset(added, 0, sizeof(Index_node_t));
+    added->offset = node->offset;
+    added->type = node->type;
+    added->parent = node->depth ? index->parents[node->depth - 1]
+                                : INDEX_NONE;
+    index->parents[node->depth] = header->nodes++;
+
+    // List elements keep their index where a name would go
+    if (!node->name) {
+        added->name = node->index;
+        return;
+    }
+
+    size_t length = node->name->length;
+    while (header->names_length + length > index->names_capacity) {
+        index->names_capacity = index->names_capacity
+                                    ? index->names_capacity * 2
+                                    : INDEX_NAMES_PREALLOC;
+        index->names = (char *) realloc(index->names,
+                                        index->names_capacity + 1);
+    }
+    if (length)
+        memcpy(index->names + header->names_length, node->name->load,
+               length);
+    added->named = 1;
+    added->name = header->names_length;
+    added->name_length = length;
+    header->names_length += length;
+}
+
+static uint32_t find_child(const Index_t *index, uint32_t node,
+                           const Path_segment_t *segment)
+{
+    for (uint32_t child = index->children[node]; child != INDEX_NONE;
+         child = index->siblings[child])
+    {
+        const Index_node_t *found = index->nodes + child;
+        if (segment->name
+                ? found->named && found->name_length == segment->length &&
+                      !memcmp(index->names + found->name, segment->name,
+                              segment->length)
+                : !found->named && found->name == (uint64_t) segment->index)
+            return child;
+    }
+    return INDEX_NONE;
+}
+
+static int path_error(Index_path_t *lookup, const char *text)
+{
+    fprintf(stderr, _ERR "Error! Invalid path \"%s\".\n" _CLEAR, text);
+    index_free_path(lookup);
+    return -1;
+}
+
+// The last checkpoint at or before the offset, if there is one
+static const Inflate_point_t *find_point(const Index_t *index,
+                                         uint64_t offset)
+{
+    size_t low = 0, high = index->header.points;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->points[middle].out <= offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low ? index->points + low - 1 : NULL;
+}
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <input.h>
+#include <print.h>
+
+//// MACROS ////
+
+#define READ_CHUNK 0x10000
+
+//// DECLARATIONS ////
+
+static int map_fd(Input_t *input, int fd);
+static int read_fd(Input_t *input, int fd);
+
+//// DEFINITIONS ////
+
+int input_open(Input_t *input, const char *path)
+{
+    input->data = NULL;
+    input->length = 0;
+    input->mapped = 0;
+
+    if (!path)
+        return map_fd(input, STDIN_FILENO);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, _ERR "Error! Can't open \"%s\": %s.\n" _CLEAR, path,
+                strerror(errno));
+        return -1;
+    }
+
+    int status = map_fd(input, fd);
+    close(fd);
+    return status;
+}
+
+void input_close(Input_t *input)
+{
+    if (input->mapped)
+        munmap((void *) input->data, input->length);
+    else
+        free((void *) input->data);
+
+    input->data = NULL;
+    input->length = 0;
+    input->mapped = 0;
+}
+
+static int map_fd(Input_t *input, int fd)
+{
+    struct stat st;
+
+    // Pipes, terminals and empty files can't be mapped
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return read_fd(input, fd);
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return read_fd(input, fd);
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    input->data = data;
+    input->length = st.st_size;
+    input->mapped = 1;
+    return 0;
+}
+
+static int read_fd(Input_t *input, int fd)
+{
+    uint8_t *buf = NULL;
+    size_t capacity = 0, length = 0;
+
+    while (1) {
+        if (length == capacity) {
+            capacity = capacity ? capacity * 2 : READ_CHUNK;
+            buf = realloc(buf, capacity);
+        }
+
+        ssize_t bytes_read = read(fd, buf + length, capacity - length);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, _ERR "Error! Can't read input: %s.\n" _CLEAR,
+                    strerror(errno));
+            free(buf);
+            return -1;
+        }
+        if (bytes_read == 0)
+            break;
+        length += bytes_read;
+    }
+
+    input->data = buf;
+    input->length = length;
+    input->mapped = 0;
+    return 0;
+}
@@ -2,70 +2,275 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <zlib.h>
 #include <unistd.h>
 
 #include <ast.h>
+#include <batch.h>
+#include <blocks.h>
+#include <census.h>
 #include <compress.h>
 #include <decompress.h>
+#include <input.h>
 #include <parse.h>
+#include <pool.h>
 #include <print.h>
+#include <region.h>
+#include <snapshot.h>
+#include <stats.h>
+
+//// MACROS ////
+
+// Binary output is written as it was read unless --output-format is given
+#define FORMAT_AS_READ 0xFF
+
+//// DECLARATIONS ////
+
+static int parse_format(const char *name);
+static double wall_seconds();
+
+//// DEFINITIONS ////
 
 int main(int argc, const char **argv)
 {
-    uint8_t parse = 0, compr = 0;
-    for (int i = 0; i < argc; i++) {
+    Batch_t batch;
+    Stats_t stats;
+    Census_t census;
+    int stats_format = STATS_OFF;
+    int read_format = NBT_JAVA;
+    int write_format = FORMAT_AS_READ;
+    const char *list_path = NULL;
+    const char **inputs = (const char **) malloc(argc * sizeof(char *));
+    int input_count = 0;
+
+    batch_init(&batch);
+
+    for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-p"))
-            parse = 1;
+            batch.options.parse = 1;
         else if (!strcmp(argv[i], "-c"))
-            compr = 1;
+            batch.options.compr = 1;
+        else if (!strcmp(argv[i], "--snapshot"))
+            batch.options.snapshot = 1;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            batch.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            batch.output_dir = argv[++i];
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            list_path = argv[++i];
+        else if (!strcmp(argv[i], "--compact"))
+            batch.options.region = REGION_COMPACT;
+        else if (!strcmp(argv[i], "--recompress"))
+            batch.options.region = REGION_RECOMPRESS;
+        else if (!strcmp(argv[i], "--blocks") ||
+                 !strcmp(argv[i], "--blocks=histogram"))
+            batch.options.blocks = BLOCKS_HISTOGRAM;
+        else if (!strcmp(argv[i], "--blocks=palette"))
+            batch.options.blocks = BLOCKS_PALETTE;
+        else if (!strcmp(argv[i], "--get") && i + 1 < argc)
+            batch.options.get = argv[++i];
+        else if (!strcmp(argv[i], "--census"))
+            batch.options.census = &census;
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+            if ((read_format = parse_format(argv[++i])) < 0) {
+                free(inputs);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--output-format") && i + 1 < argc) {
+            if ((write_format = parse_format(argv[++i])) < 0) {
+                free(inputs);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--nameless")) {
+            nbt_set_read_nameless(1);
+            nbt_set_write_nameless(1);
+            nbt_set_parse_nameless(1);
+        }
+        else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc)
+            nbt_set_max_depth(strtoul(argv[++i], NULL, 10));
+        else if (!strcmp(argv[i], "--stats") ||
+                 !strcmp(argv[i], "--stats=text"))
+            stats_format = STATS_TEXT;
+        else if (!strcmp(argv[i], "--stats=json"))
+            stats_format = STATS_JSON;
         else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
             printf(
-                "Usage: %s [options] < input_file > output_file\n"
+                "Usage: %s [options] [input_file...] > output_file\n"
                 "\n"
                 "Reads NBT file and outputs NBT file. The default behaviour "
-                "is to read binary NBT and output text NBT. Input and output "
-                "are stdin and stdout, respectively, so you must use pipes "
-                "and redirects. If the output is associated with a terminal, "
-                "the program automatically prints the output in colour.\n"
+                "is to read binary NBT and output text NBT. The input is read "
+                "from input_file, or from stdin if no file is given, and the "
+                "output goes to stdout. Binary input may be gzip, zlib or "
+                "uncompressed NBT, or a snapshot. If the output is associated "
+                "with a terminal, the program automatically prints the output "
+                "in colour.\n"
                 "\n"
-                "  -p : Parses input as text NBT.\n"
-                "  -c : Compresses output as binary NBT.\n"
-                "\n", argv[0]
+                "Given several files, directories (searched recursively), "
+                "glob patterns or a file list, every file is converted on a "
+                "pool of worker threads. The results are written to an "
+                "output directory, or else concatenated to stdout in the "
+                "order they finish. Region files have each of their chunks "
+                "converted in turn.\n"
+                "\n"
+                "  -p      : Parses input as text NBT.\n"
+                "  -c      : Compresses output as binary NBT.\n"
+                "  -o DIR  : Writes each converted file into DIR.\n"
+                "  -l FILE : Reads input paths from FILE, one per line "
+                "(- for stdin).\n"
+                "  -j N    : Uses N worker threads (default: all cores). A "
+                "single large file is compressed on N threads, and inflated "
+                "while it decodes.\n"
+                "  --snapshot\n"
+                "          : Writes output as a snapshot (.nbts), a flat "
+                "native layout that can be mapped and read in place.\n"
+                "  --compact\n"
+                "          : Rewrites region files (.mca) in place, or into "
+                "DIR, without their free sectors. Chunks are copied as they "
+                "are.\n"
+                "  --recompress\n"
+                "          : Like --compact, but recompresses every chunk "
+                "with zlib on N threads.\n"
+                "  --blocks[=palette]\n"
+                "          : Prints the blocks of each chunk section instead, "
+                "as counts per block state, or as one block per line with "
+                "its coordinates.\n"
+                "  --get PATH\n"
+                "          : Prints only the tag at PATH, such as "
+                "Data.Player.Inventory[0]. Offsets are kept in an index next "
+                "to each file, FILE.nbti, so later lookups skip to them.\n"
+                "  --census\n"
+                "          : Counts blocks, entities and block entities by "
+                "type across every region file given, such as a whole "
+                "world, and lists them once all are read.\n"
+                "  --format FORMAT\n"
+                "          : Reads and writes binary NBT as java (default), "
+                "bedrock, which is little-endian, or network, which is "
+                "Bedrock Edition's network NBT with varints.\n"
+                "  --output-format FORMAT\n"
+                "          : Writes binary NBT as FORMAT instead, such as "
+                "to convert between editions.\n"
+                "  --nameless\n"
+                "          : Reads and writes binary NBT roots without a "
+                "name, as the network protocol sends them since 1.20.2. "
+                "Such roots may be of any type.\n"
+                "  --max-depth N\n"
+                "          : Rejects binary NBT nested deeper than N "
+                "compounds and lists (default: %d).\n"
+                "  --stats[=json]\n"
+                "          : Reports time, throughput, tag counts and memory "
+                "use on stderr, as one line of text or JSON.\n"
+                "\n", argv[0], DECODE_MAX_DEPTH
             );
+            free(inputs);
             return 0;
         }
+        else if (argv[i][0] != '-' || !strcmp(argv[i], "-"))
+            inputs[input_count++] = argv[i];
+        else {
+            fprintf(stderr, _ERR "Error! Unknown option \"%s\".\n" _CLEAR,
+                    argv[i]);
+            free(inputs);
+            return -1;
+        }
     }
 
-    Named_tag_t *tag;
+    nbt_set_read_format(read_format);
+    nbt_set_write_format(write_format == FORMAT_AS_READ ? read_format
+                                                      : write_format);
 
-    if (isatty(fileno(stdout)))
-        colours = 1;
+    // Lookups step over binary NBT, so there is nothing to index in SNBT
+    if (batch.options.get && batch.options.parse) {
+        fprintf(stderr, _ERR "Error! --get only reads binary NBT.\n" _CLEAR);
+        free(inputs);
+        return -1;
+    }
 
-    if (parse)
-        tag = parse_nbt_tag();
-    else
-        tag = nbt_decompress();
+    struct stat st;
+    int status = 0;
+    double start = wall_seconds();
 
-    if (!tag) {
-        return -1;
+    if (stats_format != STATS_OFF) {
+        stats_init(&stats);
+        batch.options.stats = &stats;
     }
 
-    if (compr) {
-        fprintf(stderr, _OK "Compressing data...\n" _CLEAR);
-        nbt_compress(tag);
-        if (colours)
-            printf("\n");
+    if (batch.options.census)
+        census_init(&census);
+
+    // A single file or stdin is converted straight to stdout, but region
+    // files being rewritten always go back to disk, and a census always
+    // reports progress
+    if (!list_path && !batch.output_dir && !batch.options.region &&
+        !batch.options.census && input_count <= 1 &&
+        (!input_count || !strcmp(inputs[0], "-") ||
+         (!stat(inputs[0], &st) && !S_ISDIR(st.st_mode))))
+    {
+        const char *path = NULL;
+        if (input_count && strcmp(inputs[0], "-"))
+            path = inputs[0];
+
+        if (isatty(fileno(stdout)))
+            colours = 1;
+
+        // Files are converted one per thread in batch mode, but a single
+        // large file is compressed with all threads instead
+        batch.options.threads = pool_threads(batch.threads);
+        status = convert_file(path, stdout, &batch.options);
+
+        ast_end();
+        nbt_decompress_end();
+        nbt_compress_end();
+        snapshot_end();
     }
     else {
-        print_nbt_tag(tag);
-        if (colours)
-            printf(_CLEAR "\n");
-        else
-            printf("\n");
+        if (!batch.output_dir && isatty(fileno(stdout)))
+            colours = 1;
+
+        for (int i = 0; i < input_count && !status; i++)
+            status = batch_add_path(&batch, inputs[i]);
+        if (list_path && !status)
+            status = batch_add_list(&batch, list_path);
+
+        if (!status)
+            status = batch_run(&batch);
+
+        batch_free(&batch);
     }
 
-    free_nbt_tag(tag);
+    if (batch.options.census) {
+        census_print(&census, stdout);
+        census_free(&census);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (stats_format != STATS_OFF) {
+        fflush(stdout);
+        stats_print(&stats, stats_format, wall_seconds() - start, stderr);
+    }
+
+    free(inputs);
+    return status;
+}
+
+static int parse_format(const char *name)
+{
+    if (!strcmp(name, "java"))
+        return NBT_JAVA;
+    if (!strcmp(name, "bedrock"))
+        return NBT_BEDROCK;
+    if (!strcmp(name, "network"))
+        return NBT_NETWORK;
+
+    fprintf(stderr, _ERR "Error! Unknown format \"%s\".\n" _CLEAR, name);
+    return -1;
+}
+
+static double wall_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
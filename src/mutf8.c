@@ -0,0 +1,224 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_PATH
+#endif
+
+#include <mutf8.h>
+
+//// DECLARATIONS ////
+
+static uint8_t is_plain(uint8_t c);
+static uint8_t is_continuation(const uint8_t *data, size_t length,
+                               size_t count);
+static size_t put_utf8(uint32_t point, uint8_t *out);
+#ifdef __SSE2__
+static size_t plain_sse2(const uint8_t *data, size_t length);
+#endif
+#ifdef HAVE_AVX2_PATH
+static uint8_t has_avx2();
+static size_t plain_avx2(const uint8_t *data, size_t length);
+#endif
+
+//// DEFINITIONS ////
+
+// Length of the run at the start of data that text holds as it is, which is
+// printable ASCII other than quotes and backslashes. Most strings are one
+// such run, so they are scanned a vector at a time.
+size_t mutf8_plain(const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+
+    // Each vector path stops at the first byte that isn't plain, or else
+    // after the last whole vector
+#ifdef HAVE_AVX2_PATH
+    if (length >= 32 && has_avx2())
+        i = plain_avx2(data, length);
+#endif
+#ifdef __SSE2__
+    if (i < length && is_plain(data[i]))
+        i += plain_sse2(data + i, length - i);
+#endif
+
+    while (i < length && is_plain(data[i]))
+        i++;
+    return i;
+}
+
+// Turns the sequence of modified UTF-8 at the start of data into UTF-8,
+// joining surrogate pairs. Returns how many bytes it wrote, or 0 if there is
+// no character there that text can hold: ASCII, an encoded zero, a lone
+// surrogate or bytes that aren't modified UTF-8 at all.
+size_t mutf8_to_utf8(const uint8_t *data, size_t length,
+                     uint8_t out[UTF8_MAX], size_t *used)
+{
+    uint8_t lead = data[0];
+
+    if (lead >= 0xC2 && lead <= 0xDF && is_continuation(data, length, 1)) {
+        out[0] = data[0];
+        out[1] = data[1];
+        *used = 2;
+        return 2;
+    }
+    if (lead < 0xE0 || lead > 0xEF || !is_continuation(data, length, 2) ||
+        (lead == 0xE0 && data[1] < 0xA0))
+        return 0;
+
+    uint32_t point = (lead & 0x0F) << 12 | (data[1] & 0x3F) << 6 |
+                     (data[2] & 0x3F);
+    if (point < 0xD800 || point > 0xDFFF) {
+        *used = 3;
+        return put_utf8(point, out);
+    }
+
+    // A high surrogate has to be followed by a low one
+    if (point > 0xDBFF || length < 6 || data[3] != 0xED ||
+        data[4] < 0xB0 || data[4] > 0xBF || (data[5] & 0xC0) != 0x80)
+        return 0;
+
+    uint32_t low = 0xD000 | (data[4] & 0x3F) << 6 | (data[5] & 0x3F);
+    *used = 6;
+    return put_utf8(0x10000 + ((point - 0xD800) << 10) + (low - 0xDC00),
+                    out);
+}
+
+// The other way, for characters past ASCII in text. Supplementary
+// characters become surrogate pairs. Returns 0 for bytes that aren't UTF-8,
+// which are then taken as they are.
+size_t utf8_to_mutf8(const uint8_t *data, size_t length,
+                     uint8_t out[MUTF8_MAX], size_t *used)
+{
+    uint8_t lead = data[0];
+
+    if (lead >= 0xC2 && lead <= 0xDF && is_continuation(data, length, 1)) {
+        out[0] = data[0];
+        out[1] = data[1];
+        *used = 2;
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF && is_continuation(data, length, 2) &&
+        !(lead == 0xE0 && data[1] < 0xA0) &&
+        !(lead == 0xED && data[1] >= 0xA0))
+    {
+        out[0] = data[0];
+        out[1] = data[1];
+        out[2] = data[2];
+        *used = 3;
+        return 3;
+    }
+    if (lead < 0xF0 || lead > 0xF4 || !is_continuation(data, length, 3) ||
+        (lead == 0xF0 && data[1] < 0x90) || (lead == 0xF4 && data[1] > 0x8F))
+        return 0;
+
+    uint32_t point = (lead & 0x07) << 18 | (data[1] & 0x3F) << 12 |
+                     (data[2] & 0x3F) << 6 | (data[3] & 0x3F);
+    point -= 0x10000;
+    put_utf8(0xD800 + (point >> 10), out);
+    put_utf8(0xDC00 + (point & 0x3FF), out + 3);
+    *used = 4;
+    return 6;
+}
+
+static uint8_t is_plain(uint8_t c)
+{
+    return c >= 0x20 && c < 0x7F && c != '"' && c != '\'' && c != '\\';
+}
+
+static uint8_t is_continuation(const uint8_t *data, size_t length,
+                               size_t count)
+{
+    if (length <= count)
+        return 0;
+    for (size_t i = 1; i <= count; i++) {
+        if ((data[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return 1;
+}
+
+// Surrogates go through here too, as modified UTF-8 writes each half as if
+// it were a character of its own
+static size_t put_utf8(uint32_t point, uint8_t *out)
+{
+    if (point < 0x800) {
+        out[0] = 0xC0 | point >> 6;
+        out[1] = 0x80 | (point & 0x3F);
+        return 2;
+    }
+    if (point < 0x10000) {
+        out[0] = 0xE0 | point >> 12;
+        out[1] = 0x80 | (point >> 6 & 0x3F);
+        out[2] = 0x80 | (point & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | point >> 18;
+    out[1] = 0x80 | (point >> 12 & 0x3F);
+    out[2] = 0x80 | (point >> 6 & 0x3F);
+    out[3] = 0x80 | (point & 0x3F);
+    return 4;
+}
+
+#ifdef __SSE2__
+
+// Compared as signed, bytes past ASCII are below a space like the controls
+static size_t plain_sse2(const uint8_t *data, size_t length)
+{
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i apostrophe = _mm_set1_epi8('\'');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i stop = _mm_or_si128(
+            _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, apostrophe),
+                                      _mm_cmpeq_epi8(v, backslash))));
+        int mask = _mm_movemask_epi8(stop);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+#endif
+
+#ifdef HAVE_AVX2_PATH
+
+static uint8_t has_avx2()
+{
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+__attribute__((target("avx2"))) static size_t
+plain_avx2(const uint8_t *data, size_t length)
+{
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i apostrophe = _mm256_set1_epi8('\'');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i stop = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                            _mm256_cmpeq_epi8(v, del)),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, quote),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, apostrophe),
+                                _mm256_cmpeq_epi8(v, backslash))));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(stop);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+#endif
@@ -4,18 +4,31 @@
 #include <string.h>
 #include <zlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <ast.h>
+#include <mutf8.h>
 #include <parse.h>
 #include <print.h>
 
 //// VARIABLES ////
 
-static error_t *global_error = NULL;
+static _Thread_local error_t *global_error = NULL;
+
+static _Thread_local size_t buf_index = 0;
+static _Thread_local size_t buf_len = 0;
+
+static _Thread_local const char *out_buf = NULL;
 
-static int buf_index = 0;
-static int buf_len = 0;
+// Whether roots may be of any type, as nameless roots can
+static uint8_t nameless = 0;
 
-static char *out_buf = NULL;
+// Strings with escapes or characters past ASCII are put together here, and
+// it is kept until the end of the document
+static _Thread_local char *scratch = NULL;
+static _Thread_local size_t scratch_capacity = 0;
 
 static Tag_t *(*function_table[])() = {
     NULL,
@@ -42,28 +55,38 @@ static uint8_t next();
 static uint8_t cmp_next(const char *str);
 static uint8_t seek();
 static void skip_whitespace();
+static size_t blank_run(const uint8_t *data, size_t length);
+static uint8_t is_name_char(uint8_t c);
+static char *reserve(size_t length);
 
-static int get_state();
-static void set_state(int);
+static size_t get_state();
+static void set_state(size_t);
 
-static void parser_init();
+static uint8_t scan_token(size_t from, const char *format, void *ptr);
+
+static void parser_init(const char *data, size_t length);
 static void parser_end();
+static uint8_t check_root(size_t state, uint8_t type);
 
 //// DEFINITIONS ////
 
-Named_tag_t *parse_nbt_tag()
+Named_tag_t *parse_nbt_tag(const char *data, size_t length)
 {
-    parser_init();
+    parser_init(data, length);
 
     skip_whitespace();
 
-    int state = get_state();
+    size_t state = get_state();
 
     {
         Named_tag_t *tag = parse_named_tag();
-        
+
+        // A named root of the wrong type isn't read again as a value
+        if (tag && !check_root(state, tag->type)) {
+            free_nbt_tag(tag);
+            goto failed;
+        }
         if (tag) {
-            fprintf(stderr, _OK "Parsed successfully!\n\n" _CLEAR);
             free_error(global_error);
             parser_end();
             return tag;
@@ -72,16 +95,21 @@ Named_tag_t *parse_nbt_tag()
     
     {
         set_state(state);
-        Tag_t *tag = parse_TAG_Compound();
-    
+        // Any other value is read as a nameless root
+        Tag_t *tag = seek() == '{' ? parse_TAG_Compound() : parse_any_data();
+
+        if (tag && !check_root(state, tag->type)) {
+            free_functions[tag->type](tag);
+            tag = NULL;
+        }
         if (tag) {
-            fprintf(stderr, _OK "Parsed successfully!\n\n" _CLEAR);
             free_error(global_error);
             parser_end();
-            return new_named_tag(TAG_Compound, new_string(0), tag);
+            return new_named_tag(tag->type, new_string(0), tag);
         }
     }
 
+failed:
     fprintf(stderr, "\n");
     print_error(global_error);
     free_error(global_error);
@@ -121,18 +149,18 @@ Tag_t *parse_any_data()
     };
 
     skip_whitespace();
-    int state = get_state();
+    size_t state = get_state();
     Tag_t *longest = NULL;
-    int longest_state;
+    size_t longest_state;
 
     error_t *relevant = NULL;
-    int relevant_location;
-    int relevant_type;
+    size_t relevant_location = 0;
+    int relevant_type = 0;
     for (int i = 0; i < TOTAL_TYPES - 1; i++) {
         set_state(state);
 
         Tag_t *this = parse_funcs_ordered[i]();
-        int this_state = get_state();
+        size_t this_state = get_state();
         if (this) {
             if (!longest) {
                 longest = this;
@@ -189,47 +217,35 @@ Tag_t *parse_any_data()
 
 Tag_string_t *parse_tag_name()
 {
-    int state = get_state();
-    int16_t length = 0;
-    char *buf = NULL;
+    size_t state = get_state();
 
     if (seek() == '\'' || seek() == '"') {
         return (Tag_string_t *) parse_TAG_String();
     }
 
-    int i = 0;
-    while (1) {
-        if (i >= length) {
-            length += CHUNK;
-            buf = realloc(buf, length);
-        }
-        char c = seek();
+    // Unquoted names are copied straight from the input
+    const uint8_t *name = (const uint8_t *) out_buf + state;
+    size_t i = 0;
+    while (state + i < buf_len && is_name_char(name[i]))
+        i++;
+    if (state + i >= buf_len)
+        raise_error(state + i, "ERROR! Unexpected EOF.");
 
-        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-            (c >= '0' && c <= '9') || c == '_' || c == '-' ||
-             c == '.' || c == '+')
-        {
-            buf[i++] = next();
-        }
-        else {
-            break;
-        }
-    }
-    if (i == 0) {
-        raise_error(state, "Expected tag name.");
-        free(buf);
+    if (i == 0 || i > UINT16_MAX) {
+        raise_error(state, i ? "Tag name is too long." : "Expected tag name.");
+        set_state(state);
         return NULL;
     }
     Tag_string_t *tag = new_string(i);
-    memcpy(tag->load, buf, i);
-    free(buf);
+    memcpy(tag->load, name, i);
+    set_state(state + i);
 
     return tag;
 }
 
 Named_tag_t *parse_named_tag()
 {
-    int state = get_state();
+    size_t state = get_state();
 
     Tag_string_t *name = parse_tag_name();
     // Tag_string_t *name = (Tag_string_t *) parse_TAG_String();
@@ -262,7 +278,7 @@ Named_tag_t *parse_named_tag()
 
 Tag_t *parse_TAG_Byte()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (cmp_next("true")) {
@@ -285,7 +301,7 @@ Tag_t *parse_TAG_Byte()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %ld", (long *) read)) {
+    if (!scan_token(state, " %ld", (long *) read)) {
         raise_error(get_state(), "Not a valid byte.");
         set_state(state);
         return NULL;
@@ -295,7 +311,7 @@ Tag_t *parse_TAG_Byte()
 
 Tag_t *parse_TAG_Short()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (seek() == '-') next();
@@ -311,7 +327,7 @@ Tag_t *parse_TAG_Short()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %ld", (long *) read)) {
+    if (!scan_token(state, " %ld", (long *) read)) {
         raise_error(get_state(), "Not a valid short.");
         set_state(state);
         return NULL;
@@ -321,7 +337,7 @@ Tag_t *parse_TAG_Short()
 
 Tag_t *parse_TAG_Int()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (seek() == '-') next();
@@ -336,7 +352,7 @@ Tag_t *parse_TAG_Int()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %ld", (long *) read)) {
+    if (!scan_token(state, " %ld", (long *) read)) {
         raise_error(get_state(), "Not a valid int.");
         set_state(state);
         return NULL;
@@ -347,7 +363,7 @@ Tag_t *parse_TAG_Int()
 
 Tag_t *parse_TAG_Long()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (seek() == '-') next();
@@ -363,7 +379,7 @@ Tag_t *parse_TAG_Long()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %ld", (long *) read)) {
+    if (!scan_token(state, " %ld", (long *) read)) {
         raise_error(get_state(), "Not a valid long.");
         set_state(state);
         return NULL;
@@ -373,7 +389,7 @@ Tag_t *parse_TAG_Long()
 
 Tag_t *parse_TAG_Float()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (seek() == '-') next();
@@ -389,7 +405,7 @@ Tag_t *parse_TAG_Float()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %lg", (double *) read)) {
+    if (!scan_token(state, " %lg", (double *) read)) {
         raise_error(get_state(), "Not a valid float.");
         set_state(state);
         return NULL;
@@ -399,7 +415,7 @@ Tag_t *parse_TAG_Float()
 
 Tag_t *parse_TAG_Double()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t read[8];
 
     if (seek() == '-') next();
@@ -415,7 +431,7 @@ Tag_t *parse_TAG_Double()
         set_state(state);
         return NULL;
     }
-    if (!sscanf(out_buf + state, " %lf", (double *) read)) {
+    if (!scan_token(state, " %lf", (double *) read)) {
         raise_error(get_state(), "Not a valid double.");
         set_state(state);
         return NULL;
@@ -425,7 +441,7 @@ Tag_t *parse_TAG_Double()
 
 Tag_t *parse_TAG_Byte_Array()
 {
-    int state = get_state();
+    size_t state = get_state();
     int32_t length = 0;
     int8_t *buf = NULL;
 
@@ -447,7 +463,7 @@ Tag_t *parse_TAG_Byte_Array()
             buf = realloc(buf, length);
         }
 
-        int local_state = get_state();
+        size_t local_state = get_state();
         uint8_t read[8];
 
         skip_whitespace();
@@ -476,7 +492,7 @@ Tag_t *parse_TAG_Byte_Array()
                 free(buf);
                 return NULL;
             }
-            if (!sscanf(out_buf + local_state, " %ld", (long *) read)) {
+            if (!scan_token(local_state, " %ld", (long *) read)) {
                 raise_error(get_state(), "Not a valid byte.");
                 set_state(state);
                 free(buf);
@@ -486,7 +502,7 @@ Tag_t *parse_TAG_Byte_Array()
         }
 
         i++;
-        int comma_state = get_state();
+        size_t comma_state = get_state();
         skip_whitespace();
         if (seek() == ']') {
             next();
@@ -511,9 +527,8 @@ Tag_t *parse_TAG_Byte_Array()
 
 Tag_t *parse_TAG_String()
 {
-    int state = get_state();
-    int16_t length = 0;
-    char *buf = NULL;
+    size_t state = get_state();
+    char *buf = scratch;
 
     char delim;
 
@@ -525,21 +540,42 @@ Tag_t *parse_TAG_String()
         return NULL;
     }
 
-    int i = 0;
+    // Most strings are a single plain run, which is copied straight from
+    // the input
+    const uint8_t *text = (const uint8_t *) out_buf + buf_index;
+    size_t plain = mutf8_plain(text, buf_len - buf_index);
+    if (plain <= UINT16_MAX && buf_index + plain < buf_len &&
+        text[plain] == (uint8_t) delim)
+    {
+        Tag_string_t *tag = new_string(plain);
+        memcpy(tag->load, text, plain);
+        buf_index += plain + 1;
+        return (Tag_t *) tag;
+    }
+
+    size_t i = 0;
     while (1) {
-        if (i >= length) {
-            length += CHUNK;
-            buf = realloc(buf, length);
+        // Plain text is copied a run at a time, with room after it for the
+        // longest sequence anything else can turn into
+        const uint8_t *rest = (const uint8_t *) out_buf + buf_index;
+        size_t run = mutf8_plain(rest, buf_len - buf_index);
+        buf = reserve(i + run + MUTF8_MAX);
+        memcpy(buf + i, rest, run);
+        i += run;
+        buf_index += run;
+
+        if (buf_index >= buf_len) {
+            raise_error(state, "Unterminated string.");
+            set_state(state);
+            return NULL;
         }
-
-        if (seek() == delim) {
+        else if (seek() == delim) {
             next();
             break;
         }
         else if (seek() == '\n') {
             raise_error(get_state(), "Multiline string literal.");
             set_state(state);
-            free(buf);
             return NULL;
         }
         else if (seek() == '\\') {
@@ -584,7 +620,6 @@ Tag_t *parse_TAG_String()
                 if (!sscanf(num_buf, "%2x", &value)) {
                     raise_error(get_state(), "Invalid hex escape sequence.");
                     set_state(state);
-                    free(buf);
                     return NULL;
                 }
                 buf[i++] = (uint8_t) value & 0xFF;
@@ -606,7 +641,6 @@ Tag_t *parse_TAG_String()
                 if (!sscanf(num_buf, "%3o", &value)) {
                     raise_error(get_state(), "Invalid escape sequence.");
                     set_state(state);
-                    free(buf);
                     return NULL;
                 }
                 buf[i++] = (uint8_t) value & 0xFF;
@@ -615,23 +649,40 @@ Tag_t *parse_TAG_String()
             }
         }
         else {
-            buf[i++] = next();
+            // Text is UTF-8, and strings modified UTF-8
+            uint8_t mutf8[MUTF8_MAX];
+            size_t used;
+            size_t written = utf8_to_mutf8((const uint8_t *) out_buf +
+                                               buf_index,
+                                           buf_len - buf_index, mutf8, &used);
+            if (written) {
+                memcpy(buf + i, mutf8, written);
+                i += written;
+                buf_index += used;
+            }
+            else
+                buf[i++] = next();
         }
     }
 
+    if (i > UINT16_MAX) {
+        raise_error(state, "String is too long.");
+        set_state(state);
+        return NULL;
+    }
+
     Tag_string_t *tag = new_string(i);
     memcpy(tag->load, buf, i);
-    free(buf);
     return (Tag_t *) tag;
 }
 
 Tag_t *parse_TAG_List()
 {
-    int state = get_state();
+    size_t state = get_state();
     uint8_t type = 0;
-    int types_tried[TOTAL_TYPES] = {0};
+    size_t types_tried[TOTAL_TYPES] = {0};
     int i = 0;
-    List_node_t *list = new_nodes_list();
+    Builder_t list = new_builder();
 
     if (seek() == '[') {
         next();
@@ -642,12 +693,12 @@ Tag_t *parse_TAG_List()
         return NULL;
     }
 
-    int first_state = get_state();
+    size_t first_state = get_state();
 
     skip_whitespace();
     if (seek() == ']') {
         next();
-        Tag_list_t *tag = finalise_nodes_list(0, NULL);
+        Tag_list_t *tag = finalise_list_builder(0, NULL);
         return (Tag_t *) tag;
     }
 
@@ -657,7 +708,7 @@ Tag_t *parse_TAG_List()
             next();
             break;
         }
-        int this_state = get_state();
+        size_t this_state = get_state();
         if (!type) {
             // First ever element (checking type)
 
@@ -666,7 +717,7 @@ Tag_t *parse_TAG_List()
                 // Succeeded parsing element
 
                 type = this->type;
-                list = add_list_node(list, this);
+                builder_add(&list, this);
                 i++;
             }
             else {
@@ -684,7 +735,7 @@ Tag_t *parse_TAG_List()
             if (this) {
                 // Possibly succeeded in parsing element
 
-                list = add_list_node(list, this);
+                builder_add(&list, this);
                 i++;
 
                 skip_whitespace();
@@ -706,13 +757,13 @@ Tag_t *parse_TAG_List()
             if (this) {
                 // Succeeded parsing element with new type
 
-                free_tag_list((Tag_t *) finalise_nodes_list(type, list));
-                list = new_nodes_list();
+                free_tag_list((Tag_t *) finalise_list_builder(type, &list));
                 type = this->type;
+                free_functions[type](this);
                 if (types_tried[type]) {
                     // Type already been tested
                     raise_error(types_tried[type], "List is not homogeneous.");
-                    free_tag_list((Tag_t *) finalise_nodes_list(0, list));
+                    free_tag_list((Tag_t *) finalise_list_builder(0, &list));
                     return NULL;
                 }
                 else {
@@ -727,12 +778,12 @@ Tag_t *parse_TAG_List()
                 // Malformed element
                 append_error(get_state(), "Expected a valid element.");
                 set_state(state);
-                free_tag_list((Tag_t *) finalise_nodes_list(type, list));
+                free_tag_list((Tag_t *) finalise_list_builder(type, &list));
                 return NULL;
             }
         }
 
-        int comma_state = get_state();
+        size_t comma_state = get_state();
         skip_whitespace();
         if (seek() == ']') {
             next();
@@ -744,19 +795,19 @@ Tag_t *parse_TAG_List()
         else {
             raise_error(comma_state, "Expected a comma or closing brackets.");
             set_state(state);
-            free_tag_list((Tag_t *) finalise_nodes_list(type, list));
+            free_tag_list((Tag_t *) finalise_list_builder(type, &list));
             return NULL;
         }
     }
 
-    Tag_list_t *tag = finalise_nodes_list(type, list);
+    Tag_list_t *tag = finalise_list_builder(type, &list);
     return (Tag_t *) tag;
 }
 
 Tag_t *parse_TAG_Compound()
 {
-    int state = get_state();
-    Compound_node_t *list = new_compound_list();
+    size_t state = get_state();
+    Builder_t list = new_builder();
 
     if (seek() == '{') {
         next();
@@ -781,17 +832,17 @@ Tag_t *parse_TAG_Compound()
         }
         Named_tag_t *this = parse_named_tag();
         if (this) {
-            list = add_compound_node(list, this);
+            builder_add(&list, this);
         }
         else {
             append_error(get_state(),
                          "Expected a valid tag or closing braces.");
             set_state(state);
-            free_tag_compound((Tag_t *) new_compound(list));
+            free_tag_compound((Tag_t *) new_compound(&list));
             return NULL;
         }
 
-        int comma_state = get_state();
+        size_t comma_state = get_state();
         skip_whitespace();
         if (seek() == '}') {
             next();
@@ -803,18 +854,18 @@ Tag_t *parse_TAG_Compound()
         else {
             raise_error(comma_state, "Expected a comma or closing braces.");
             set_state(state);
-            free_tag_compound((Tag_t *) new_compound(list));
+            free_tag_compound((Tag_t *) new_compound(&list));
             return NULL;
         }
     }
 
-    Tag_compound_t *tag = new_compound(list);
+    Tag_compound_t *tag = new_compound(&list);
     return (Tag_t *) tag;
 }
 
 Tag_t *parse_TAG_Int_Array()
 {
-    int state = get_state();
+    size_t state = get_state();
     int32_t length = 0;
     int32_t *buf = NULL;
 
@@ -837,7 +888,7 @@ Tag_t *parse_TAG_Int_Array()
             buf = realloc(buf, length * sizeof(uint32_t));
         }
 
-        int local_state = get_state();
+        size_t local_state = get_state();
         uint8_t read[8];
 
         skip_whitespace();
@@ -859,7 +910,7 @@ Tag_t *parse_TAG_Int_Array()
             free(buf);
             return NULL;
         }
-        if (!sscanf(out_buf + local_state, " %ld", (long *) read)) {
+        if (!scan_token(local_state, " %ld", (long *) read)) {
             raise_error(get_state(), "Not a valid int.");
             set_state(state);
             free(buf);
@@ -868,7 +919,7 @@ Tag_t *parse_TAG_Int_Array()
         buf[i] = *(long *) read;
 
         i++;
-        int comma_state = get_state();
+        size_t comma_state = get_state();
         skip_whitespace();
         if (seek() == ']') {
             next();
@@ -893,7 +944,7 @@ Tag_t *parse_TAG_Int_Array()
 
 Tag_t *parse_TAG_Long_Array()
 {
-    int state = get_state();
+    size_t state = get_state();
     int32_t length = 0;
     int64_t *buf = NULL;
 
@@ -915,7 +966,7 @@ Tag_t *parse_TAG_Long_Array()
             buf = realloc(buf, length * sizeof(uint64_t));
         }
 
-        int local_state = get_state();
+        size_t local_state = get_state();
         uint8_t read[8];
 
         skip_whitespace();
@@ -938,7 +989,7 @@ Tag_t *parse_TAG_Long_Array()
             free(buf);
             return NULL;
         }
-        if (!sscanf(out_buf + local_state, " %ld", (long *) read)) {
+        if (!scan_token(local_state, " %ld", (long *) read)) {
             raise_error(get_state(), "Not a valid long.");
             set_state(state);
             free(buf);
@@ -947,7 +998,7 @@ Tag_t *parse_TAG_Long_Array()
         buf[i] = *(long *) read;
 
         i++;
-        int comma_state = get_state();
+        size_t comma_state = get_state();
         skip_whitespace();
         if (seek() == ']') {
             next();
@@ -970,20 +1021,55 @@ Tag_t *parse_TAG_Long_Array()
     return (Tag_t *) tag;
 }
 
-static void parser_init()
+// Applies to every thread, so it is set before any start parsing
+void nbt_set_parse_nameless(uint8_t new_nameless)
+{
+    nameless = new_nameless;
+}
+
+// Named roots are compounds, as the binary formats can't hold anything else
+static uint8_t check_root(size_t state, uint8_t type)
+{
+    if (nameless || type == TAG_Compound)
+        return 1;
+    raise_error(state, "Root tag is not compound.");
+    return 0;
+}
+
+static void parser_init(const char *data, size_t length)
 {
-    buf_len = 0;
+    buf_len = length;
     buf_index = 0;
-    out_buf = NULL;
-    do {
-        out_buf = (char *) realloc(out_buf, buf_len + CHUNK);
-        buf_len += fread(out_buf + buf_len, 1, CHUNK, stdin);
-    } while (!feof(stdin));
+    out_buf = data;
 }
 
 static void parser_end()
 {
-    free(out_buf);
+    out_buf = NULL;
+
+    free(scratch);
+    scratch = NULL;
+    scratch_capacity = 0;
+}
+
+static uint8_t scan_token(size_t from, const char *format, void *ptr)
+{
+    // The input is not NUL-terminated, so numbers are scanned from a copy
+    char token[TOKEN_MAX + 1];
+
+    while (from < get_state() && (out_buf[from] == ' ' ||
+           out_buf[from] == '\t' || out_buf[from] == '\n'))
+    {
+        from++;
+    }
+
+    size_t length = get_state() - from;
+
+    if (length > TOKEN_MAX) length = TOKEN_MAX;
+    memcpy(token, out_buf + from, length);
+    token[length] = 0x00;
+
+    return sscanf(token, format, ptr) == 1;
 }
 
 static uint8_t next()
@@ -1006,7 +1092,7 @@ static uint8_t seek()
 
 static uint8_t cmp_next(const char *str)
 {
-    int state = get_state();
+    size_t state = get_state();
     for (int i = 0; str[i]; i++) {
         if (next() != str[i]) {
             set_state(state);
@@ -1018,25 +1104,76 @@ static uint8_t cmp_next(const char *str)
 
 static void skip_whitespace()
 {
-    char c = seek();
-    while (1) {
-        if (c != ' ' && c != '\t' && c != '\n') break;
-        next();
-        c = seek();
+    buf_index += blank_run((const uint8_t *) out_buf + buf_index,
+                           buf_len - buf_index);
+    if (buf_index >= buf_len)
+        raise_error(buf_index, "ERROR! Unexpected EOF.");
+}
+
+// Length of the whitespace at the start of data. Indentation can be long in
+// deeply nested text, so it is scanned 16 bytes at a time.
+static size_t blank_run(const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+
+    if (length == 0 || (data[0] != ' ' && data[0] != '\t' && data[0] != '\n'))
+        return 0;
+
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i blank = _mm_or_si128(
+            _mm_cmpeq_epi8(v, space),
+            _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, newline)));
+        int mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    while (i < length && (data[i] == ' ' || data[i] == '\t' ||
+           data[i] == '\n'))
+    {
+        i++;
+    }
+    return i;
+}
+
+static uint8_t is_name_char(uint8_t c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' ||
+           c == '.' || c == '+';
+}
+
+// Grows the scratch buffer to hold at least length bytes
+static char *reserve(size_t length)
+{
+    if (length > scratch_capacity) {
+        size_t capacity = scratch_capacity ? scratch_capacity : CHUNK;
+        while (capacity < length)
+            capacity *= 2;
+        scratch = realloc(scratch, capacity);
+        scratch_capacity = capacity;
     }
+    return scratch;
 }
 
-static inline int get_state()
+static inline size_t get_state()
 {
     return buf_index;
 }
 
-static inline void set_state(int state)
+static inline void set_state(size_t state)
 {
     buf_index = state;
 }
 
-void raise_error(int location, const char *message)
+void raise_error(size_t location, const char *message)
 {
     free_error(global_error);
 
@@ -1050,7 +1187,7 @@ void raise_error(int location, const char *message)
     global_error = new;
 }
 
-void append_error(int location, const char *message)
+void append_error(size_t location, const char *message)
 {
     // fprintf(stderr, _ERR "+ Error appended: \"%s\"\n", message);
 
@@ -1086,9 +1223,9 @@ void print_error(error_t *error)
     print_error(error->previous);
     if (error->previous) fprintf(stderr, _ERR "Which caused: ");
 
-    int location = error->location;
-    int line = 1, column = 1;
-    for (int i = 0; i < location; i++) {
+    size_t location = error->location;
+    size_t line = 1, column = 1;
+    for (size_t i = 0; i < location; i++) {
         column++;
         if (out_buf[i] == '\n') {
             line++;
@@ -1097,12 +1234,11 @@ void print_error(error_t *error)
     }
     fprintf(stderr,
             _ERR "Error! " _CLEAR "%s\n" _ERR
-                 "- at line %d, column %d.\n" _CLEAR,
+                 "- at line %zu, column %zu.\n" _CLEAR,
             error->message, line, column);
     for (int i = -10; i < 10; i++) {
-        int idx = location + i;
         char c;
-        if (idx < 0 || idx >= buf_len) {
+        if ((i < 0 && location < (size_t) -i) || location + i >= buf_len) {
             c = '.';
         }
         else if (out_buf[location + i] == '\t'
@@ -0,0 +1,81 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pool.h>
+
+//// STRUCTS ////
+
+typedef struct Pool_s
+{
+    atomic_size_t next_job;
+    size_t jobs;
+    void (*job)(void *, size_t);
+    void (*done)(void *);
+    void *ctx;
+} Pool_t;
+
+//// DECLARATIONS ////
+
+static void *worker(void *arg);
+
+//// DEFINITIONS ////
+
+int pool_threads(int requested)
+{
+    if (requested > 0)
+        return requested;
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int) online : 1;
+}
+
+void pool_run(int threads, size_t jobs, void (*job)(void *, size_t),
+              void (*done)(void *), void *ctx)
+{
+    Pool_t pool = {0};
+    pool.jobs = jobs;
+    pool.job = job;
+    pool.done = done;
+    pool.ctx = ctx;
+    atomic_init(&pool.next_job, 0);
+
+    if ((size_t) threads > jobs)
+        threads = jobs;
+
+    // The calling thread always takes part, so one thread means no spawning
+    pthread_t *workers = NULL;
+    int spawned = 0;
+    if (threads > 1) {
+        workers = (pthread_t *) malloc((threads - 1) * sizeof(pthread_t));
+        for (; spawned < threads - 1; spawned++) {
+            if (pthread_create(workers + spawned, NULL, worker, &pool))
+                break;
+        }
+    }
+
+    worker(&pool);
+
+    for (int i = 0; i < spawned; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+}
+
+static void *worker(void *arg)
+{
+    Pool_t *pool = (Pool_t *) arg;
+
+    // Jobs are handed out one at a time, so uneven sizes balance themselves
+    while (1) {
+        size_t index = atomic_fetch_add_explicit(&pool->next_job, 1,
+                                                 memory_order_relaxed);
+        if (index >= pool->jobs) break;
+        pool->job(pool->ctx, index);
+    }
+
+    if (pool->done)
+        pool->done(pool->ctx);
+    return NULL;
+}
@@ -1,4 +1,5 @@
 #include <ast.h>
+#include <mutf8.h>
 #include <print.h>
 
 #include <stdint.h>
@@ -7,7 +8,8 @@
 
 //// VARIABLES ////
 
-int _indent = 0;
+static _Thread_local int _indent = 0;
+static _Thread_local FILE *out = NULL;
 uint8_t colours = 0;
 
 const char *type_strings[] = {
@@ -32,112 +34,143 @@ void (*print_functions[])(Tag_t *) = {
     print_tag_long_array,
 };
 
+//// DECLARATIONS ////
+
+static void print_tag_name(Tag_string_t *name);
+static void print_tree(Tag_t *root, uint8_t type);
+static void print_value(Tag_t *tag, uint8_t type);
+static void open_container(uint8_t type);
+static void close_container(uint8_t type);
+static void separate();
+
 //// DEFINITIONS ////
 
 void print_tag_end(Tag_t *ptr)
 {
     if (colours)
-        printf(_ERR "NULL");
+        fprintf(out, _ERR "NULL");
     else
-        printf("NULL");
+        fprintf(out, "NULL");
 }
 
 void print_tag_byte(Tag_t *ptr)
 {
     const Tag_byte_t *tag = (Tag_byte_t *) ptr;
     if (colours)
-        printf(_VAL "%d" _TYPE "b", tag->load);
+        fprintf(out, _VAL "%d" _TYPE "b", tag->load);
     else
-        printf("%db", tag->load);
+        fprintf(out, "%db", tag->load);
 }
 
 void print_tag_short(Tag_t *ptr)
 {
     const Tag_short_t *tag = (Tag_short_t *) ptr;
     if (colours)
-        printf(_VAL "%d" _TYPE "s", tag->load);
+        fprintf(out, _VAL "%d" _TYPE "s", tag->load);
     else
-        printf("%ds", tag->load);
+        fprintf(out, "%ds", tag->load);
 }
 
 void print_tag_int(Tag_t *ptr)
 {
     const Tag_int_t *tag = (Tag_int_t *) ptr;
     if (colours)
-        printf(_VAL "%d", tag->load);
+        fprintf(out, _VAL "%d", tag->load);
     else
-        printf("%d", tag->load);
+        fprintf(out, "%d", tag->load);
 }
 
 void print_tag_long(Tag_t *ptr)
 {
     const Tag_long_t *tag = (Tag_long_t *) ptr;
     if (colours)
-        printf(_VAL "%ld" _TYPE "l", tag->load);
+        fprintf(out, _VAL "%ld" _TYPE "l", tag->load);
     else
-        printf("%ldl", tag->load);
+        fprintf(out, "%ldl", tag->load);
 }
 
 void print_tag_float(Tag_t *ptr)
 {
     const Tag_float_t *tag = (Tag_float_t *) ptr;
     if (colours)
-        printf(_VAL "%f" _TYPE "f", tag->load);
+        fprintf(out, _VAL "%f" _TYPE "f", tag->load);
     else
-        printf("%ff", tag->load);
+        fprintf(out, "%ff", tag->load);
 }
 
 void print_tag_double(Tag_t *ptr)
 {
     const Tag_double_t *tag = (Tag_double_t *) ptr;
     if (colours)
-        printf(_VAL "%lf" _TYPE "d", tag->load);
+        fprintf(out, _VAL "%lf" _TYPE "d", tag->load);
     else
-        printf("%lfd", tag->load);
+        fprintf(out, "%lfd", tag->load);
 }
 
 void print_tag_byte_array(Tag_t *ptr)
 {
     const Tag_byte_array_t *tag = (Tag_byte_array_t *) ptr;
     if (colours)
-        printf(_PUNCT "[" _TYPE "B" _PUNCT ";");
+        fprintf(out, _PUNCT "[" _TYPE "B" _PUNCT ";");
     else
-        printf("[B;");
+        fprintf(out, "[B;");
     space();
 
     for (int i = 0; i < tag->length; i++) {
         if (i > 0) {
             if (colours)
-                printf(_PUNCT ",");
+                fprintf(out, _PUNCT ",");
             else
-                printf(",");
+                fprintf(out, ",");
             space();
         }
 
         if (colours)
-            printf(_VAL "%d" _TYPE "b", tag->load[i]);
+            fprintf(out, _VAL "%d" _TYPE "b", tag->load[i]);
         else
-            printf("%db", tag->load[i]);
+            fprintf(out, "%db", tag->load[i]);
     }
 
     if (colours)
-        printf(_PUNCT "]");
+        fprintf(out, _PUNCT "]");
     else
-        printf("]");
+        fprintf(out, "]");
 }
 
+// Strings are modified UTF-8, and come out as UTF-8 a run at a time. Bytes
+// that don't make a character are escaped in octal, three digits each so
+// that a digit after them can't be taken for part of them.
 static void print_safe_str(Tag_string_t const *tag)
 {
-    for (int i = 0; i < tag->length; i++) {
-        uint8_t c = tag->load[i];
+    const uint8_t *load = (const uint8_t *) tag->load;
+    size_t length = tag->length;
+    uint8_t utf8[UTF8_MAX];
+    size_t i = 0, used, written;
+
+    while (1) {
+        size_t run = mutf8_plain(load + i, length - i);
+        fwrite(load + i, 1, run, out);
+        if ((i += run) == length)
+            break;
+
+        uint8_t c = load[i];
         if (c == '"' || c == '\\') {
-            printf("\\%c", c);
+            fprintf(out, "\\%c", c);
+            i++;
+        }
+        else if (c == '\'') {
+            putc(c, out);
+            i++;
         }
-        else if (c >= 0x20 && c < 0x7F) {
-            putchar(c);
+        else if ((written = mutf8_to_utf8(load + i, length - i, utf8,
+                                          &used)))
+        {
+            fwrite(utf8, 1, written, out);
+            i += used;
         }
         else {
-            printf("\\%o", c);
+            fprintf(out, "\\%03o", c);
+            i++;
         }
     }
 }
@@ -147,146 +180,93 @@ void print_tag_string(Tag_t *ptr)
     const Tag_string_t *tag = (Tag_string_t *) ptr;
 
     if (colours)
-        printf(_STR "\"");
+        fprintf(out, _STR "\"");
     else
-        printf("\"");
+        fprintf(out, "\"");
 
     print_safe_str(tag);
 
     if (colours)
-        printf("\"" _CLEAR);
+        fprintf(out, "\"" _CLEAR);
     else
-        printf("\"");
+        fprintf(out, "\"");
 }
 
 void print_tag_list(Tag_t *ptr)
 {
-    const Tag_list_t *tag = (Tag_list_t *) ptr;
-    if (colours)
-        printf(_PUNCT "[");
-    else
-        printf("[");
-
-    new_line();
-    increase_indentation();
-    for (int i = 0; i < tag->length; i++) {
-        if (i > 0) {
-            if (colours)
-                printf(_PUNCT ",");
-            else
-                printf(",");
-            space();
-            new_line();
-        }
-        indent_line();
-        print_functions[tag->list_type](tag->load[i]);
-    }
-
-    decrease_indentation();
-    new_line();
-    indent_line();
-    if (colours)
-        printf(_PUNCT "]");
-    else
-        printf("]");
+    print_tree(ptr, TAG_List);
 }
 
 void print_tag_compound(Tag_t *ptr)
 {
-    const Tag_compound_t *tag = (Tag_compound_t *) ptr;
-
-    if (colours)
-        printf(_PUNCT "{");
-    else
-        printf("{");
-
-    new_line();
-    increase_indentation();
-    for (int i = 0; tag->load[i]; i++) {
-        if (i > 0) {
-            if (colours)
-                printf(_PUNCT ",");
-            else
-                printf(",");
-            space();
-            new_line();
-        }
-
-        indent_line();
-        print_named_tag(tag->load[i]);
-    }
-    new_line();
-    decrease_indentation();
-    indent_line();
-
-    if (colours)
-        printf(_PUNCT "}");
-    else
-        printf("}");
+    print_tree(ptr, TAG_Compound);
 }
 
 void print_tag_int_array(Tag_t *ptr)
 {
     const Tag_int_array_t *tag = (Tag_int_array_t *) ptr;
     if (colours)
-        printf(_PUNCT "[" _TYPE "I" _PUNCT ";");
+        fprintf(out, _PUNCT "[" _TYPE "I" _PUNCT ";");
     else
-        printf("[I;");
+        fprintf(out, "[I;");
     space();
 
     for (int i = 0; i < tag->length; i++) {
         if (i > 0) {
             if (colours)
-                printf(_PUNCT ",");
+                fprintf(out, _PUNCT ",");
             else
-                printf(",");
+                fprintf(out, ",");
             space();
         }
 
         if (colours)
-            printf(_VAL "%d", tag->load[i]);
+            fprintf(out, _VAL "%d", tag->load[i]);
         else
-            printf("%d", tag->load[i]);
+            fprintf(out, "%d", tag->load[i]);
     }
 
     if (colours)
-        printf(_PUNCT "]");
+        fprintf(out, _PUNCT "]");
     else
-        printf("]");
+        fprintf(out, "]");
 }
 
 void print_tag_long_array(Tag_t *ptr)
 {
     const Tag_long_array_t *tag = (Tag_long_array_t *) ptr;
     if (colours)
-        printf(_PUNCT "[" _TYPE "L" _PUNCT ";");
+        fprintf(out, _PUNCT "[" _TYPE "L" _PUNCT ";");
     else
-        printf("[L;");
+        fprintf(out, "[L;");
     space();
 
     for (int i = 0; i < tag->length; i++) {
         if (i > 0) {
             if (colours)
-                printf(_PUNCT ",");
+                fprintf(out, _PUNCT ",");
             else
-                printf(",");
+                fprintf(out, ",");
             space();
         }
 
         if (colours)
-            printf(_VAL "%ld" _TYPE "l", tag->load[i]);
+            fprintf(out, _VAL "%ld" _TYPE "l", tag->load[i]);
         else
-            printf("%ldl", tag->load[i]);
+            fprintf(out, "%ldl", tag->load[i]);
     }
 
     if (colours)
-        printf(_PUNCT "]");
+        fprintf(out, _PUNCT "]");
     else
-        printf("]");
+        fprintf(out, "]");
 }
 
+// Empty names are quoted too, or they couldn't be read back
 static uint8_t is_safe_str(Tag_string_t const *tag)
 {
+    if (!tag->length)
+        return 0;
     for (int i = 0; i < tag->length; i++) {
         uint8_t c = tag->load[i];
         if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
@@ -301,53 +281,165 @@ static uint8_t is_safe_str(Tag_string_t const *tag)
 
 void print_named_tag(Named_tag_t *tag)
 {
-    uint8_t safe = is_safe_str(tag->name);
+    print_tag_name(tag->name);
+    print_value(tag->tag, tag->type);
+}
+
+static void print_tag_name(Tag_string_t *name)
+{
+    uint8_t safe = is_safe_str(name);
 
     if (colours)
-        printf(_STR "\"");
+        fprintf(out, _STR "\"");
     else if (!safe)
-        printf("\"");
+        fprintf(out, "\"");
 
-    print_safe_str(tag->name);
+    print_safe_str(name);
 
     if (colours)
-        printf("\"" _PUNCT ":");
+        fprintf(out, "\"" _PUNCT ":");
     else if (!safe)
-        printf("\":");
+        fprintf(out, "\":");
     else
-        printf(":");
+        fprintf(out, ":");
     space();
+}
 
-    print_functions[tag->type](tag->tag);
+// Opening brackets are printed on the way down and closing ones on the way
+// back up, with an explicit stack in place of recursion
+static void print_tree(Tag_t *root, uint8_t type)
+{
+    size_t base = walk_depth();
+
+    open_container(type);
+    walk_push(type, root);
+
+    while (walk_depth() > base) {
+        Walk_frame_t *frame = walk_top();
+        Tag_t *child;
+
+        if (frame->type == TAG_Compound) {
+            Tag_compound_t *tag = (Tag_compound_t *) frame->tag;
+            Named_tag_t *member = tag->load[frame->index];
+            if (!member) {
+                close_container(TAG_Compound);
+                walk_pop();
+                continue;
+            }
+            if (frame->index++ > 0)
+                separate();
+            indent_line();
+            print_tag_name(member->name);
+            child = member->tag;
+            type = member->type;
+        }
+        else {
+            Tag_list_t *tag = (Tag_list_t *) frame->tag;
+            if (frame->index == tag->length) {
+                close_container(TAG_List);
+                walk_pop();
+                continue;
+            }
+            if (frame->index > 0)
+                separate();
+            indent_line();
+            child = tag->load[frame->index++];
+            type = tag->list_type;
+        }
+
+        if (type == TAG_Compound || type == TAG_List) {
+            open_container(type);
+            walk_push(type, child);
+        }
+        else
+            print_value(child, type);
+    }
 }
 
-void print_nbt_tag(Named_tag_t *tag)
+static void print_value(Tag_t *tag, uint8_t type)
 {
-    if (tag->type != TAG_Compound) {
-        fprintf(stderr, _ERR "Error! Root tag is not compound." _CLEAR);
-        exit(1);
+    switch (type) {
+    case TAG_End:        print_tag_end(tag); break;
+    case TAG_Byte:       print_tag_byte(tag); break;
+    case TAG_Short:      print_tag_short(tag); break;
+    case TAG_Int:        print_tag_int(tag); break;
+    case TAG_Long:       print_tag_long(tag); break;
+    case TAG_Float:      print_tag_float(tag); break;
+    case TAG_Double:     print_tag_double(tag); break;
+    case TAG_Byte_Array: print_tag_byte_array(tag); break;
+    case TAG_String:     print_tag_string(tag); break;
+    case TAG_List:
+    case TAG_Compound:   print_tree(tag, type); break;
+    case TAG_Int_Array:  print_tag_int_array(tag); break;
+    case TAG_Long_Array: print_tag_long_array(tag); break;
     }
+}
+
+static void open_container(uint8_t type)
+{
+    const char *bracket = type == TAG_Compound ? "{" : "[";
+
+    if (colours)
+        fprintf(out, _PUNCT "%s", bracket);
+    else
+        fprintf(out, "%s", bracket);
+
+    new_line();
+    increase_indentation();
+}
+
+static void close_container(uint8_t type)
+{
+    const char *bracket = type == TAG_Compound ? "}" : "]";
+
+    new_line();
+    decrease_indentation();
+    indent_line();
+
+    if (colours)
+        fprintf(out, _PUNCT "%s", bracket);
+    else
+        fprintf(out, "%s", bracket);
+}
+
+static void separate()
+{
+    if (colours)
+        fprintf(out, _PUNCT ",");
+    else
+        fprintf(out, ",");
+    space();
+    new_line();
+}
+
+// Unnamed roots are printed as their value alone, which is how nameless
+// roots of any type come back too
+int print_nbt_tag(Named_tag_t *tag, FILE *stream)
+{
+    out = stream;
+    _indent = 0;
 
     if (tag->name->length)
         print_named_tag(tag);
     else
-        print_tag_compound(tag->tag);
+        print_value(tag->tag, tag->type);
+    return 0;
 }
 
 inline void indent_line()
 {
     if (colours)
-        for (int i = 0; i < _indent; ++i) printf("  ");
+        for (int i = 0; i < _indent; ++i) fprintf(out, "  ");
 }
 
 inline void new_line()
 {
-    if (colours) printf("\n");
+    if (colours) fprintf(out, "\n");
 }
 
 inline void space()
 {
-    if (colours) printf(" ");
+    if (colours) fprintf(out, " ");
 }
 
 inline void increase_indentation()
@@ -0,0 +1,329 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ast.h>
+#include <compress.h>
+#include <decompress.h>
+#include <input.h>
+#include <pool.h>
+#include <print.h>
+#include <region.h>
+
+//// STRUCTS ////
+
+typedef struct Encoded_chunk_s
+{
+    uint8_t *out;
+    size_t length;
+    int status;
+} Encoded_chunk_t;
+
+typedef struct Region_encode_s
+{
+    Region_t *region;
+    size_t *indices;
+    Encoded_chunk_t *encoded;
+    pthread_t caller;
+} Region_encode_t;
+
+//// VARIABLES ////
+
+static const uint8_t padding[REGION_SECTOR] = {0};
+
+//// DECLARATIONS ////
+
+static uint8_t is_readable(const Region_chunk_t *chunk);
+static void encode_chunk(void *ctx, size_t index);
+static void encode_chunk_done(void *ctx);
+static void chunk_error(const Region_t *region, size_t index,
+                        const char *message);
+static uint32_t get_be32(const uint8_t *in);
+static void put_be32(uint8_t *out, uint32_t value);
+
+//// DEFINITIONS ////
+
+uint8_t is_region_path(const char *path)
+{
+    size_t length = path ? strlen(path) : 0;
+    size_t extension = strlen(REGION_EXTENSION);
+
+    if (length < extension)
+        return 0;
+    return !strcmp(path + length - extension, REGION_EXTENSION) ||
+           !strcmp(path + length - extension, REGION_LEGACY_EXTENSION);
+}
+
+int region_open(Region_t *region, const char *path)
+{
+    memset(region, 0, sizeof(Region_t));
+    if (input_open(&region->input, path))
+        return -1;
+    region->path = strdup(path ? path : "-");
+
+    const uint8_t *data = region->input.data;
+    size_t length = region->input.length;
+
+    // The game leaves empty files behind for regions without chunks
+    if (!length)
+        return 0;
+    if (length < REGION_HEADER) {
+        fprintf(stderr, _ERR "Error! \"%s\" has a truncated header.\n" _CLEAR,
+                region->path);
+        region_close(region);
+        return -1;
+    }
+
+    for (size_t i = 0; i < REGION_CHUNKS; i++) {
+        Region_chunk_t *chunk = region->chunks + i;
+        uint32_t location = get_be32(data + 4 * i);
+        size_t offset = (size_t) (location >> 8) * REGION_SECTOR;
+        size_t sectors = location & 0xFF;
+
+        chunk->timestamp = get_be32(data + REGION_SECTOR + 4 * i);
+        if (!location)
+            continue;
+
+        // The last chunk isn't always padded out to a whole sector
+        if (offset < REGION_HEADER || !sectors ||
+            offset + CHUNK_HEADER > length)
+        {
+            chunk_error(region, i, "lies outside the file.");
+            region_close(region);
+            return -1;
+        }
+        size_t size = get_be32(data + offset);
+        if (!size || size + 4 > sectors * REGION_SECTOR ||
+            size > length - offset - 4)
+        {
+            chunk_error(region, i, "has an invalid length.");
+            region_close(region);
+            return -1;
+        }
+
+        chunk->compression = data[offset + 4];
+        chunk->data = data + offset + CHUNK_HEADER;
+        chunk->length = size - 1;
+    }
+    return 0;
+}
+
+uint8_t region_has_chunk(const Region_t *region, size_t index)
+{
+    const Region_chunk_t *chunk = region->chunks + index;
+    return chunk->data || chunk->tag;
+}
+
+// Decodes the chunk as stored, and reports errors with the chunk's index
+Named_tag_t *region_read_chunk(const Region_t *region, size_t index)
+{
+    return region_read_chunk_only(region, index, NULL);
+}
+
+// Decodes only the parts of the chunk on the given paths, or all of it
+Named_tag_t *region_read_chunk_only(const Region_t *region, size_t index,
+                                    const char *const *paths)
+{
+    const Region_chunk_t *chunk = region->chunks + index;
+
+    if (!chunk->data)
+        return NULL;
+    if (!is_readable(chunk)) {
+        chunk_error(region, index,
+                    chunk->compression & CHUNK_EXTERNAL
+                        ? "is stored in a separate file."
+                        : "uses an unsupported compression.");
+        return NULL;
+    }
+
+    Named_tag_t *tag = nbt_decompress_only(chunk->data, chunk->length,
+                                           paths);
+    if (!tag) {
+        flockfile(stderr);
+        fprintf(stderr, _ERR "%s, chunk %zu:\n" _CLEAR, region->path, index);
+        print_decode_error(get_decode_error());
+        funlockfile(stderr);
+    }
+    return tag;
+}
+
+// Takes ownership of the tag, which is compressed when the region is written
+void region_set_chunk(Region_t *region, size_t index, Named_tag_t *tag)
+{
+    Region_chunk_t *chunk = region->chunks + index;
+
+    if (chunk->tag)
+        free_nbt_tag(chunk->tag);
+    chunk->tag = tag;
+    chunk->timestamp = (uint32_t) time(NULL);
+}
+
+// Changed chunks are compressed on separate threads, and all others are
+// copied as they were. Chunks are laid out back to back in index order,
+// so the free sectors left by earlier rewrites disappear.
+int region_write(Region_t *region, FILE *stream, int threads)
+{
+    Region_encode_t encode;
+    size_t count = 0;
+    int status = 0;
+
+    encode.region = region;
+    encode.caller = pthread_self();
+    encode.indices = (size_t *) malloc(REGION_CHUNKS * sizeof(size_t));
+    encode.encoded = (Encoded_chunk_t *) calloc(REGION_CHUNKS,
+                                                sizeof(Encoded_chunk_t));
+
+    for (size_t i = 0; i < REGION_CHUNKS; i++) {
+        Region_chunk_t *chunk = region->chunks + i;
+        if (chunk->tag || (chunk->recompress && is_readable(chunk)))
+            encode.indices[count++] = i;
+    }
+    if (count)
+        pool_run(threads, count, encode_chunk, encode_chunk_done, &encode);
+
+    uint8_t *header = (uint8_t *) calloc(REGION_HEADER, 1);
+    size_t sector = REGION_HEADER / REGION_SECTOR;
+
+    for (size_t i = 0; i < REGION_CHUNKS && !status; i++) {
+        Region_chunk_t *chunk = region->chunks + i;
+        Encoded_chunk_t *encoded = encode.encoded + i;
+        size_t length = encoded->out ? encoded->length : chunk->length;
+
+        put_be32(header + REGION_SECTOR + 4 * i, chunk->timestamp);
+        if (encoded->status)
+            status = -1;
+        if (!region_has_chunk(region, i) || status)
+            continue;
+
+        size_t sectors = (CHUNK_HEADER + length + REGION_SECTOR - 1) /
+                         REGION_SECTOR;
+        if (sectors > REGION_MAX_SECTORS) {
+            chunk_error(region, i, "is too large for a region file.");
+            status = -1;
+            continue;
+        }
+        put_be32(header + 4 * i, (uint32_t) (sector << 8 | sectors));
+        sector += sectors;
+    }
+
+    if (!status && fwrite(header, REGION_HEADER, 1, stream) != 1) {
+        fprintf(stderr, _ERR "Error! Couldn't write output.\n" _CLEAR);
+        status = -1;
+    }
+
+    for (size_t i = 0; i < REGION_CHUNKS && !status; i++) {
+        Region_chunk_t *chunk = region->chunks + i;
+        Encoded_chunk_t *encoded = encode.encoded + i;
+        if (!region_has_chunk(region, i))
+            continue;
+
+        const uint8_t *data = encoded->out ? encoded->out : chunk->data;
+        size_t length = encoded->out ? encoded->length : chunk->length;
+        uint8_t chunk_header[CHUNK_HEADER];
+
+        put_be32(chunk_header, (uint32_t) length + 1);
+        chunk_header[4] = encoded->out ? CHUNK_ZLIB : chunk->compression;
+
+        size_t gap = (REGION_SECTOR - (CHUNK_HEADER + length) %
+                                          REGION_SECTOR) % REGION_SECTOR;
+        if (fwrite(chunk_header, CHUNK_HEADER, 1, stream) != 1 ||
+            (length && fwrite(data, length, 1, stream) != 1) ||
+            (gap && fwrite(padding, gap, 1, stream) != 1))
+        {
+            fprintf(stderr, _ERR "Error! Couldn't write output.\n" _CLEAR);
+            status = -1;
+        }
+    }
+
+    for (size_t i = 0; i < REGION_CHUNKS; i++)
+        free(encode.encoded[i].out);
+    free(encode.encoded);
+    free(encode.indices);
+    free(header);
+    return status;
+}
+
+void region_close(Region_t *region)
+{
+    for (size_t i = 0; i < REGION_CHUNKS; i++) {
+        if (region->chunks[i].tag)
+            free_nbt_tag(region->chunks[i].tag);
+    }
+    input_close(&region->input);
+    free(region->path);
+    region->path = NULL;
+}
+
+static uint8_t is_readable(const Region_chunk_t *chunk)
+{
+    return chunk->data && (chunk->compression == CHUNK_GZIP ||
+                           chunk->compression == CHUNK_ZLIB ||
+                           chunk->compression == CHUNK_NONE);
+}
+
+static void encode_chunk(void *ctx, size_t index)
+{
+    Region_encode_t *encode = (Region_encode_t *) ctx;
+    size_t chunk_index = encode->indices[index];
+    Region_chunk_t *chunk = encode->region->chunks + chunk_index;
+    Encoded_chunk_t *encoded = encode->encoded + chunk_index;
+
+    Named_tag_t *tag = chunk->tag;
+    if (!tag && !(tag = region_read_chunk(encode->region, chunk_index))) {
+        encoded->status = -1;
+        return;
+    }
+
+    const uint8_t *data;
+    size_t length;
+    if (nbt_serialise(tag, &data, &length) ||
+        nbt_deflate_zlib(data, length, &data, &length))
+    {
+        encoded->status = -1;
+    }
+    else {
+        encoded->out = (uint8_t *) malloc(length);
+        memcpy(encoded->out, data, length);
+        encoded->length = length;
+    }
+
+    if (tag != chunk->tag)
+        free_nbt_tag(tag);
+}
+
+// pool_run also calls this on the thread that called it, which may be a
+// batch worker with files still to go, so that one keeps its state
+static void encode_chunk_done(void *ctx)
+{
+    Region_encode_t *encode = (Region_encode_t *) ctx;
+
+    if (pthread_equal(pthread_self(), encode->caller))
+        return;
+    ast_end();
+    nbt_decompress_end();
+    nbt_compress_end();
+}
+
+static void chunk_error(const Region_t *region, size_t index,
+                        const char *message)
+{
+    fprintf(stderr, _ERR "Error! Chunk %zu of \"%s\" %s\n" _CLEAR, index,
+            region->path, message);
+}
+
+static uint32_t get_be32(const uint8_t *in)
+{
+    return (uint32_t) in[0] << 24 | (uint32_t) in[1] << 16 |
+           (uint32_t) in[2] << 8 | (uint32_t) in[3];
+}
+
+static void put_be32(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
@@ -0,0 +1,783 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ast.h>
+#include <print.h>
+#include <snapshot.h>
+
+//// STRUCTS ////
+
+// A container whose records are still to be written
+typedef struct Pending_s
+{
+    uint64_t record;
+    Tag_t *tag;
+    uint8_t type;
+} Pending_t;
+
+typedef struct Name_key_s
+{
+    const int8_t *load;
+    uint32_t length;
+    uint64_t hash;
+} Name_key_t;
+
+//// VARIABLES ////
+
+// Snapshots are built in one buffer per thread, reused between calls
+static _Thread_local uint8_t *out = NULL;
+static _Thread_local size_t out_length = 0;
+static _Thread_local size_t out_capacity = 0;
+
+static _Thread_local Pending_t *pending = NULL;
+static _Thread_local size_t pending_length = 0;
+static _Thread_local size_t pending_capacity = 0;
+
+// Names seen so far in order, and open addressing over them
+static _Thread_local Name_key_t *names = NULL;
+static _Thread_local size_t names_length = 0;
+static _Thread_local size_t names_capacity = 0;
+static _Thread_local uint32_t *slots = NULL;
+static _Thread_local size_t slot_capacity = 0;
+
+static _Thread_local Snapshot_frame_t *frames = NULL;
+static _Thread_local size_t frame_count = 0;
+static _Thread_local size_t frame_capacity = 0;
+
+// Bytes a number takes in a list of numbers, or 0 for lists of records
+static const size_t number_size[] = {
+    0, 1, 2, 4, 8, 4, 8, 0, 0, 0, 0, 0, 0,
+};
+
+// Bytes each element of an array or string takes
+static const size_t element_size[] = {
+    0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 4, 8,
+};
+
+//// DECLARATIONS ////
+
+static uint64_t reserve(size_t size);
+static void put_record(uint64_t at, Tag_t *tag, uint8_t type);
+static void put_members(const Pending_t *container);
+static void put_elements(const Pending_t *container);
+static void push_pending(uint64_t record, Tag_t *tag, uint8_t type);
+static uint32_t intern(const Tag_string_t *name);
+static uint32_t *name_slot(const int8_t *load, uint32_t length,
+                           uint64_t hash);
+static uint64_t hash_name(const int8_t *name, size_t length);
+
+static const void *at(const Snapshot_t *snapshot, uint64_t offset,
+                      uint64_t count, size_t size);
+static Tag_t *read_value(const Snapshot_t *snapshot,
+                         const Snapshot_tag_t *tag, size_t *spent);
+static Tag_t *read_numbers(const Snapshot_t *snapshot,
+                           const Snapshot_tag_t *tag, size_t *spent);
+static uint8_t open_frame(const Snapshot_t *snapshot,
+                          const Snapshot_tag_t *tag, Tag_string_t *name,
+                          size_t *spent);
+static Tag_t *close_frame(Snapshot_frame_t *frame);
+static uint8_t is_container(const Snapshot_tag_t *tag);
+static void corrupt(const Snapshot_t *snapshot, const void *where);
+
+//// DEFINITIONS ////
+
+uint8_t snapshot_is(const uint8_t *data, size_t length)
+{
+    return length >= sizeof(Snapshot_header_t) &&
+           !memcmp(data, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+}
+
+// Lays the tree out in the calling thread's buffer, which stays valid until
+// the next call. Containers are written out from an explicit stack, so deep
+// nesting costs no C stack.
+int snapshot_serialise(const Named_tag_t *tag, const uint8_t **data,
+                       size_t *length)
+{
+    out_length = 0;
+    names_length = 0;
+    for (size_t i = 0; i < slot_capacity; i++)
+        slots[i] = SNAPSHOT_NONE;
+
+    reserve(sizeof(Snapshot_header_t));
+    ((Snapshot_header_t *) out)->root.name = intern(tag->name);
+    put_record(offsetof(Snapshot_header_t, root.tag), tag->tag, tag->type);
+
+    while (pending_length) {
+        Pending_t container = pending[--pending_length];
+        if (container.type == TAG_Compound)
+            put_members(&container);
+        else
+            put_elements(&container);
+    }
+
+    uint64_t table = reserve(names_length * sizeof(Snapshot_name_t));
+    for (size_t i = 0; i < names_length; i++) {
+        uint64_t bytes = reserve(names[i].length + 1);
+        Snapshot_name_t *name = (Snapshot_name_t *) (out + table) + i;
+
+        memcpy(out + bytes, names[i].load, names[i].length);
+        name->offset = bytes;
+        name->length = names[i].length;
+    }
+
+    Snapshot_header_t *header = (Snapshot_header_t *) out;
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->order = SNAPSHOT_ORDER;
+    header->size = out_length;
+    header->names = table;
+    header->names_length = names_length;
+
+    *data = out;
+    *length = out_length;
+    return 0;
+}
+
+void snapshot_end()
+{
+    free(out);
+    out = NULL;
+    out_length = out_capacity = 0;
+
+    free(pending);
+    pending = NULL;
+    pending_length = pending_capacity = 0;
+
+    free(names);
+    free(slots);
+    names = NULL;
+    slots = NULL;
+    names_length = names_capacity = slot_capacity = 0;
+
+    free(frames);
+    frames = NULL;
+    frame_count = frame_capacity = 0;
+}
+
+// Only the header is checked, so opening costs the same whatever the size.
+// Everything else is checked as it is read.
+int snapshot_open(Snapshot_t *snapshot, const uint8_t *data, size_t length)
+{
+    const Snapshot_header_t *header = (const Snapshot_header_t *) data;
+
+    snapshot->data = data;
+    snapshot->length = length;
+    snapshot->header = header;
+
+    if (!snapshot_is(data, length) || (uintptr_t) data % SNAPSHOT_ALIGN) {
+        fprintf(stderr, _ERR "Error! Not a snapshot.\n" _CLEAR);
+        return -1;
+    }
+    if (header->order != SNAPSHOT_ORDER ||
+        header->version != SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, _ERR "Error! The snapshot was written by another "
+                "version or on a machine of the other byte order.\n" _CLEAR);
+        return -1;
+    }
+    if (header->size > length || header->size < sizeof(Snapshot_header_t) ||
+        header->size % SNAPSHOT_ALIGN)
+    {
+        fprintf(stderr, _ERR "Error! The snapshot is truncated.\n" _CLEAR);
+        return -1;
+    }
+
+    snapshot->length = header->size;
+    if (!at(snapshot, header->names, header->names_length,
+            sizeof(Snapshot_name_t)))
+    {
+        corrupt(snapshot, data + offsetof(Snapshot_header_t, names));
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the member of the compound with the given name, or NULL
+const Snapshot_tag_t *snapshot_get(const Snapshot_t *snapshot,
+                                   const Snapshot_tag_t *compound,
+                                   const char *name, size_t length)
+{
+    if (compound->type != TAG_Compound)
+        return NULL;
+
+    const Snapshot_member_t *members = (const Snapshot_member_t *) at(
+        snapshot, compound->load.offset, compound->length,
+        sizeof(Snapshot_member_t));
+    if (!members)
+        return NULL;
+
+    for (uint32_t i = 0; i < compound->length; i++) {
+        uint32_t found_length;
+        const char *found =
+            snapshot_name(snapshot, members[i].name, &found_length);
+        if (found && found_length == length && !memcmp(found, name, length))
+            return &members[i].tag;
+    }
+    return NULL;
+}
+
+// Copies out an element of a list, which may be the list itself. Numbers in
+// lists of numbers come as records of their own.
+int snapshot_element(const Snapshot_t *snapshot, const Snapshot_tag_t *list,
+                     uint32_t index, Snapshot_tag_t *element)
+{
+    if (list->type != TAG_List || list->list_type > TAG_Long_Array ||
+        index >= list->length)
+        return -1;
+
+    const uint8_t *number = (const uint8_t *) snapshot_payload(snapshot, list);
+    uint8_t type = list->list_type;
+    if (number) {
+        number += index * number_size[type];
+        memset(element, 0, sizeof(Snapshot_tag_t));
+        element->type = type;
+
+        switch (type) {
+        case TAG_Byte:   element->load.integer = *(int8_t *) number; break;
+        case TAG_Short:  element->load.integer = *(int16_t *) number; break;
+        case TAG_Int:    element->load.integer = *(int32_t *) number; break;
+        case TAG_Long:   element->load.integer = *(int64_t *) number; break;
+        case TAG_Float:  element->load.real = *(float *) number; break;
+        case TAG_Double: element->load.real = *(double *) number; break;
+        }
+        return 0;
+    }
+
+    const Snapshot_tag_t *elements = (const Snapshot_tag_t *) at(
+        snapshot, list->load.offset, list->length, sizeof(Snapshot_tag_t));
+    if (number_size[type] || !elements)
+        return -1;
+    *element = elements[index];
+    return 0;
+}
+
+// The bytes of a string or the elements of an array or list of numbers
+const void *snapshot_payload(const Snapshot_t *snapshot,
+                             const Snapshot_tag_t *tag)
+{
+    switch (tag->type) {
+    case TAG_Byte_Array:
+        return at(snapshot, tag->load.offset, tag->length, sizeof(int8_t));
+    case TAG_String:
+        return at(snapshot, tag->load.offset, tag->length + 1,
+                  sizeof(char));
+    case TAG_Int_Array:
+        return at(snapshot, tag->load.offset, tag->length, sizeof(int32_t));
+    case TAG_Long_Array:
+        return at(snapshot, tag->load.offset, tag->length, sizeof(int64_t));
+    case TAG_List:
+        if (tag->list_type <= TAG_Long_Array && number_size[tag->list_type])
+            return at(snapshot, tag->load.offset, tag->length,
+                      number_size[tag->list_type]);
+    }
+    return NULL;
+}
+
+const char *snapshot_name(const Snapshot_t *snapshot, uint32_t name,
+                          uint32_t *length)
+{
+    const Snapshot_header_t *header = snapshot->header;
+    const Snapshot_name_t *table = (const Snapshot_name_t *) (
+        snapshot->data + header->names);
+
+    if (name >= header->names_length ||
+        !at(snapshot, table[name].offset, table[name].length + 1, 1))
+        return NULL;
+    *length = table[name].length;
+    return (const char *) snapshot->data + table[name].offset;
+}
+
+// Decodes the tag and everything below it back into a tree
+Tag_t *snapshot_tree(const Snapshot_t *snapshot, const Snapshot_tag_t *tag)
+{
+    size_t base = frame_count;
+    size_t spent = sizeof(Snapshot_header_t);
+    Tag_string_t *name = NULL;
+    Tag_t *value;
+    uint8_t type;
+
+    if (!is_container(tag))
+        return read_value(snapshot, tag, &spent);
+    if (!open_frame(snapshot, tag, NULL, &spent))
+        return NULL;
+
+    while (1) {
+        Snapshot_frame_t *frame = frames + frame_count - 1;
+
+        if (frame->next == frame->length) {
+            // A finished container becomes a value of the frame below it
+            value = close_frame(frame);
+            type = frame->type;
+            name = frame->name;
+            if (--frame_count == base)
+                return value;
+        }
+        else {
+            if (frame->type == TAG_Compound) {
+                const Snapshot_member_t *member =
+                    (const Snapshot_member_t *) (snapshot->data +
+                                                 frame->records) +
+                    frame->next++;
+                uint32_t length;
+                const char *bytes =
+                    snapshot_name(snapshot, member->name, &length);
+
+                tag = &member->tag;
+                if (!bytes || length > UINT16_MAX || tag->type == TAG_End) {
+                    corrupt(snapshot, member);
+                    goto failed;
+                }
+                name = new_string(length);
+                memcpy(name->load, bytes, length);
+            }
+            else {
+                tag = (const Snapshot_tag_t *) (snapshot->data +
+                                                frame->records) +
+                      frame->next++;
+                if (tag->type != frame->list->list_type) {
+                    corrupt(snapshot, tag);
+                    goto failed;
+                }
+            }
+
+            type = tag->type;
+            if (is_container(tag)) {
+                if (!open_frame(snapshot, tag, name, &spent))
+                    goto failed;
+                name = NULL;
+                continue;
+            }
+            if (!(value = read_value(snapshot, tag, &spent)))
+                goto failed;
+        }
+
+        frame = frames + frame_count - 1;
+        if (frame->type == TAG_Compound)
+            builder_add(&frame->members, new_named_tag(type, name, value));
+        else
+            frame->list->load[frame->list->length++] = value;
+        name = NULL;
+    }
+
+failed:
+    if (name)
+        free_tag_string((Tag_t *) name);
+    while (frame_count > base) {
+        Snapshot_frame_t *frame = frames + frame_count - 1;
+        if (frame->name)
+            free_tag_string((Tag_t *) frame->name);
+        free_functions[frame->type](close_frame(frame));
+        frame_count--;
+    }
+    return NULL;
+}
+
+// Decodes the root of a snapshot opened with snapshot_open
+Named_tag_t *snapshot_decode(const Snapshot_t *snapshot)
+{
+    const Snapshot_member_t *root = &snapshot->header->root;
+    uint32_t length;
+    const char *bytes = snapshot_name(snapshot, root->name, &length);
+
+    if (!bytes || length > UINT16_MAX || root->tag.type == TAG_End ||
+        root->tag.type > TAG_Long_Array) {
+        corrupt(snapshot, root);
+        return NULL;
+    }
+
+    Tag_t *tag = snapshot_tree(snapshot, &root->tag);
+    if (!tag)
+        return NULL;
+
+    Tag_string_t *name = new_string(length);
+    memcpy(name->load, bytes, length);
+    return new_named_tag(root->tag.type, name, tag);
+}
+
+// Hands out the next aligned, zeroed stretch of the buffer. Offsets stay
+// valid as it grows, pointers into it don't.
+static uint64_t reserve(size_t size)
+{
+    size_t offset = out_length;
+    size_t aligned = (size + SNAPSHOT_ALIGN - 1) & ~(size_t) SNAPSHOT_MASK;
+
+    if (out_length + aligned > out_capacity) {
+        while (out_length + aligned > out_capacity)
+            out_capacity =
+                out_capacity ? out_capacity * 2 : SNAPSHOT_PREALLOC;
+        out = (uint8_t *) realloc(out, out_capacity);
+    }
+    memset(out + offset, 0, aligned);
+    out_length += aligned;
+    return offset;
+}
+
+// Fills in the record at the given offset. Payloads are reserved right
+// away, except for containers, which wait on the pending stack.
+static void put_record(uint64_t at, Tag_t *tag, uint8_t type)
+{
+    uint64_t payload = 0;
+    uint32_t length = 0;
+    const void *bytes = NULL;
+    size_t size = 0;
+
+    switch (type) {
+    case TAG_Byte_Array: {
+        Tag_byte_array_t *array = (Tag_byte_array_t *) tag;
+        length = array->length;
+        bytes = array->load;
+        size = length * sizeof(int8_t);
+        break;
+    }
+    case TAG_String: {
+        Tag_string_t *string = (Tag_string_t *) tag;
+        length = string->length;
+        bytes = string->load;
+        size = length + 1;
+        break;
+    }
+    case TAG_Int_Array: {
+        Tag_int_array_t *array = (Tag_int_array_t *) tag;
+        length = array->length;
+        bytes = array->load;
+        size = length * sizeof(int32_t);
+        break;
+    }
+    case TAG_Long_Array: {
+        Tag_long_array_t *array = (Tag_long_array_t *) tag;
+        length = array->length;
+        bytes = array->load;
+        size = length * sizeof(int64_t);
+        break;
+    }
+    }
+    if (bytes) {
+        payload = reserve(size);
+        memcpy(out + payload, bytes, type == TAG_String ? length : size);
+    }
+
+    Snapshot_tag_t *record = (Snapshot_tag_t *) (out + at);
+    record->type = type;
+    record->length = length;
+    record->load.offset = payload;
+
+    switch (type) {
+    case TAG_Byte:   record->load.integer = ((Tag_byte_t *) tag)->load; break;
+    case TAG_Short:  record->load.integer = ((Tag_short_t *) tag)->load; break;
+    case TAG_Int:    record->load.integer = ((Tag_int_t *) tag)->load; break;
+    case TAG_Long:   record->load.integer = ((Tag_long_t *) tag)->load; break;
+    case TAG_Float:  record->load.real = ((Tag_float_t *) tag)->load; break;
+    case TAG_Double: record->load.real = ((Tag_double_t *) tag)->load; break;
+    case TAG_List: {
+        Tag_list_t *list = (Tag_list_t *) tag;
+        record->list_type = list->list_type;
+        record->length = list->length;
+        push_pending(at, tag, type);
+        break;
+    }
+    case TAG_Compound: {
+        Tag_compound_t *compound = (Tag_compound_t *) tag;
+        while (compound->load[length])
+            length++;
+        record->length = length;
+        push_pending(at, tag, type);
+        break;
+    }
+    }
+}
+
+static void put_members(const Pending_t *container)
+{
+    Tag_compound_t *compound = (Tag_compound_t *) container->tag;
+    uint32_t length = ((Snapshot_tag_t *) (out + container->record))->length;
+    uint64_t members = reserve(length * sizeof(Snapshot_member_t));
+
+    ((Snapshot_tag_t *) (out + container->record))->load.offset = members;
+    for (uint32_t i = 0; i < length; i++) {
+        Named_tag_t *member = compound->load[i];
+        uint64_t at = members + i * sizeof(Snapshot_member_t);
+
+        ((Snapshot_member_t *) (out + at))->name = intern(member->name);
+        put_record(at + offsetof(Snapshot_member_t, tag), member->tag,
+                   member->type);
+    }
+}
+
+// Lists of numbers become native arrays, and lists of anything else
+// records of their own
+static void put_elements(const Pending_t *container)
+{
+    Tag_list_t *list = (Tag_list_t *) container->tag;
+    size_t size = number_size[list->list_type];
+    uint64_t elements =
+        reserve(list->length * (size ? size : sizeof(Snapshot_tag_t)));
+
+    ((Snapshot_tag_t *) (out + container->record))->load.offset = elements;
+    for (int32_t i = 0; i < list->length; i++) {
+        Tag_t *element = list->load[i];
+        uint8_t *slot = out + elements + i * size;
+
+        switch (list->list_type) {
+        case TAG_Byte:
+            *(int8_t *) slot = ((Tag_byte_t *) element)->load;
+            break;
+        case TAG_Short:
+            *(int16_t *) slot = ((Tag_short_t *) element)->load;
+            break;
+        case TAG_Int:
+            *(int32_t *) slot = ((Tag_int_t *) element)->load;
+            break;
+        case TAG_Long:
+            *(int64_t *) slot = ((Tag_long_t *) element)->load;
+            break;
+        case TAG_Float:
+            *(float *) slot = ((Tag_float_t *) element)->load;
+            break;
+        case TAG_Double:
+            *(double *) slot = ((Tag_double_t *) element)->load;
+            break;
+        default:
+            put_record(elements + i * sizeof(Snapshot_tag_t), element,
+                       list->list_type);
+        }
+    }
+}
+
+static void push_pending(uint64_t record, Tag_t *tag, uint8_t type)
+{
+    if (pending_length == pending_capacity) {
+        pending_capacity =
+            pending_capacity ? pending_capacity * 2 : WALK_PREALLOC;
+        pending = (Pending_t *) realloc(pending,
+                                        pending_capacity * sizeof(Pending_t));
+    }
+    pending[pending_length++] = (Pending_t) {record, tag, type};
+}
+
+// Returns the name's index in the table, adding it the first time
+static uint32_t intern(const Tag_string_t *name)
+{
+    uint64_t hash = hash_name(name->load, name->length);
+
+    // The table grows at half full, keeping probe runs short
+    if ((names_length + 1) * 2 > slot_capacity) {
+        slot_capacity = slot_capacity ? slot_capacity * 2 : SNAPSHOT_NAMES;
+        slots = (uint32_t *) realloc(slots, slot_capacity * sizeof(uint32_t));
+        for (size_t i = 0; i < slot_capacity; i++)
+            slots[i] = SNAPSHOT_NONE;
+        for (size_t i = 0; i < names_length; i++)
+            *name_slot(names[i].load, names[i].length, names[i].hash) = i;
+    }
+
+    uint32_t *slot = name_slot(name->load, name->length, hash);
+    if (*slot != SNAPSHOT_NONE)
+        return *slot;
+
+    if (names_length == names_capacity) {
+        names_capacity = names_capacity ? names_capacity * 2 : SNAPSHOT_NAMES;
+        names = (Name_key_t *) realloc(names,
+                                       names_capacity * sizeof(Name_key_t));
+    }
+    names[names_length] = (Name_key_t) {name->load, name->length, hash};
+    return *slot = names_length++;
+}
+
+static uint32_t *name_slot(const int8_t *load, uint32_t length, uint64_t hash)
+{
+    size_t mask = slot_capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t index = slots[i];
+        if (index == SNAPSHOT_NONE ||
+            (names[index].hash == hash && names[index].length == length &&
+             !memcmp(names[index].load, load, length)))
+            return slots + i;
+    }
+}
+
+// FNV-1a
+static uint64_t hash_name(const int8_t *name, size_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+// Points at count items of the given size, if they lie inside the snapshot
+// on an aligned offset
+static const void *at(const Snapshot_t *snapshot, uint64_t offset,
+                      uint64_t count, size_t size)
+{
+    if (offset % SNAPSHOT_ALIGN || offset > snapshot->length ||
+        count > (snapshot->length - offset) / size)
+        return NULL;
+    return snapshot->data + offset;
+}
+
+// Anything read counts against the size of the snapshot, so offsets that
+// point back at data already read can't make a loop or blow up
+static Tag_t *read_value(const Snapshot_t *snapshot,
+                         const Snapshot_tag_t *tag, size_t *spent)
+{
+    const void *payload = NULL;
+
+    if (tag->length > INT32_MAX ||
+        (tag->type == TAG_String && tag->length > UINT16_MAX))
+    {
+        corrupt(snapshot, tag);
+        return NULL;
+    }
+    if (tag->type <= TAG_Long_Array && element_size[tag->type]) {
+        payload = snapshot_payload(snapshot, tag);
+        if (payload)
+            *spent += tag->length * element_size[tag->type];
+        if (!payload || *spent > snapshot->length) {
+            corrupt(snapshot, tag);
+            return NULL;
+        }
+    }
+
+    switch (tag->type) {
+    case TAG_End:    return new_end();
+    case TAG_Byte:   return (Tag_t *) new_byte(tag->load.integer);
+    case TAG_Short:  return (Tag_t *) new_short(tag->load.integer);
+    case TAG_Int:    return (Tag_t *) new_int(tag->load.integer);
+    case TAG_Long:   return (Tag_t *) new_long(tag->load.integer);
+    case TAG_Float:  return (Tag_t *) new_float(tag->load.real);
+    case TAG_Double: return (Tag_t *) new_double(tag->load.real);
+    case TAG_List:   return read_numbers(snapshot, tag, spent);
+    case TAG_Byte_Array: {
+        Tag_byte_array_t *array = new_byte_array(tag->length);
+        memcpy(array->load, payload, tag->length * sizeof(int8_t));
+        return (Tag_t *) array;
+    }
+    case TAG_String: {
+        Tag_string_t *string = new_string(tag->length);
+        memcpy(string->load, payload, tag->length);
+        return (Tag_t *) string;
+    }
+    case TAG_Int_Array: {
+        Tag_int_array_t *array = new_int_array(tag->length);
+        memcpy(array->load, payload, tag->length * sizeof(int32_t));
+        return (Tag_t *) array;
+    }
+    case TAG_Long_Array: {
+        Tag_long_array_t *array = new_long_array(tag->length);
+        memcpy(array->load, payload, tag->length * sizeof(int64_t));
+        return (Tag_t *) array;
+    }
+    }
+
+    corrupt(snapshot, tag);
+    return NULL;
+}
+
+static Tag_t *read_numbers(const Snapshot_t *snapshot,
+                           const Snapshot_tag_t *tag, size_t *spent)
+{
+    const uint8_t *numbers =
+        (const uint8_t *) snapshot_payload(snapshot, tag);
+
+    if (numbers)
+        *spent += tag->length * number_size[tag->list_type];
+    if (!numbers || *spent > snapshot->length) {
+        corrupt(snapshot, tag);
+        return NULL;
+    }
+
+    size_t size = number_size[tag->list_type];
+    Tag_list_t *list = new_list(tag->list_type, tag->length);
+    for (uint32_t i = 0; i < tag->length; i++) {
+        const uint8_t *number = numbers + i * size;
+        Tag_t *element = NULL;
+
+        switch (tag->list_type) {
+        case TAG_Byte:
+            element = (Tag_t *) new_byte(*(const int8_t *) number);
+            break;
+        case TAG_Short:
+            element = (Tag_t *) new_short(*(const int16_t *) number);
+            break;
+        case TAG_Int:
+            element = (Tag_t *) new_int(*(const int32_t *) number);
+            break;
+        case TAG_Long:
+            element = (Tag_t *) new_long(*(const int64_t *) number);
+            break;
+        case TAG_Float:
+            element = (Tag_t *) new_float(*(const float *) number);
+            break;
+        case TAG_Double:
+            element = (Tag_t *) new_double(*(const double *) number);
+            break;
+        }
+        list->load[i] = element;
+    }
+    return (Tag_t *) list;
+}
+
+static uint8_t open_frame(const Snapshot_t *snapshot,
+                          const Snapshot_tag_t *tag, Tag_string_t *name,
+                          size_t *spent)
+{
+    size_t size = tag->type == TAG_Compound ? sizeof(Snapshot_member_t)
+                                            : sizeof(Snapshot_tag_t);
+
+    *spent += tag->length * size;
+    if (tag->length > INT32_MAX ||
+        !at(snapshot, tag->load.offset, tag->length, size) ||
+        *spent > snapshot->length)
+    {
+        corrupt(snapshot, tag);
+        return 0;
+    }
+
+    if (frame_count == frame_capacity) {
+        frame_capacity = frame_capacity ? frame_capacity * 2 : WALK_PREALLOC;
+        frames = (Snapshot_frame_t *) realloc(
+            frames, frame_capacity * sizeof(Snapshot_frame_t));
+    }
+
+    Snapshot_frame_t *frame = frames + frame_count++;
+    frame->type = tag->type;
+    frame->name = name;
+    frame->records = tag->load.offset;
+    frame->length = tag->length;
+    frame->next = 0;
+
+    if (tag->type == TAG_Compound)
+        frame->members = new_builder();
+    else {
+        frame->list = new_list(tag->list_type, tag->length);
+        frame->list->length = 0;
+    }
+    return 1;
+}
+
+static Tag_t *close_frame(Snapshot_frame_t *frame)
+{
+    if (frame->type == TAG_Compound)
+        return (Tag_t *) new_compound(&frame->members);
+    return (Tag_t *) frame->list;
+}
+
+// Compounds, and lists of anything but numbers
+static uint8_t is_container(const Snapshot_tag_t *tag)
+{
+    return tag->type == TAG_Compound ||
+           (tag->type == TAG_List && tag->list_type <= TAG_Long_Array &&
+            !number_size[tag->list_type]);
+}
+
+static void corrupt(const Snapshot_t *snapshot, const void *where)
+{
+    fprintf(stderr, _ERR "Error! Corrupt snapshot at byte %zu.\n" _CLEAR,
+            (size_t) ((const uint8_t *) where - snapshot->data));
+}
@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <ast.h>
+#include <print.h>
+#include <stats.h>
+
+//// STRUCTS ////
+
+typedef struct Counted_stream_s
+{
+    FILE *stream;
+    size_t *count;
+} Counted_stream_t;
+
+//// VARIABLES ////
+
+static const char *phase_names[] = {
+    "inflate", "decode", "parse", "print", "serialise", "deflate",
+};
+
+#ifdef AST_ACCOUNTING
+static const char *alloc_names[] = {"named_tags", "builders"};
+#endif
+
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//// DECLARATIONS ////
+
+static double clock_seconds(clockid_t clock);
+static void count_tree(Stats_t *stats, Tag_t *root, uint8_t type);
+static ssize_t counted_write(void *cookie, const char *data, size_t size);
+static int counted_close(void *cookie);
+static size_t peak_rss();
+#ifdef AST_ACCOUNTING
+static void print_accounting(int format, FILE *stream);
+#endif
+
+//// DEFINITIONS ////
+
+void stats_init(Stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+// Both calls do nothing without a Stats_t, so callers can time every phase
+// unconditionally and only pay for the clocks when --stats was given
+Stats_clock_t stats_start(const Stats_t *stats)
+{
+    Stats_clock_t start = {0, 0};
+
+    if (stats) {
+        start.wall = clock_seconds(CLOCK_MONOTONIC);
+        start.cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+    }
+    return start;
+}
+
+void stats_stop(Stats_t *stats, int phase, Stats_clock_t start, size_t bytes)
+{
+    if (!stats)
+        return;
+
+    stats->phases[phase].wall += clock_seconds(CLOCK_MONOTONIC) - start.wall;
+    stats->phases[phase].cpu +=
+        clock_seconds(CLOCK_THREAD_CPUTIME_ID) - start.cpu;
+    stats->phase_bytes[phase] += bytes;
+    stats->ran[phase] = 1;
+}
+
+void stats_count_tags(Stats_t *stats, const Named_tag_t *root)
+{
+    if (stats)
+        count_tree(stats, root->tag, root->type);
+}
+
+// Wraps an output stream so that everything written through it is counted,
+// which also works for pipes where the position can't be queried
+FILE *stats_stream(FILE *stream, size_t *count)
+{
+    static const cookie_io_functions_t functions = {
+        .write = counted_write,
+        .close = counted_close,
+    };
+    Counted_stream_t *cookie = malloc(sizeof(Counted_stream_t));
+
+    cookie->stream = stream;
+    cookie->count = count;
+
+    FILE *counted = fopencookie(cookie, "w", functions);
+    if (!counted)
+        free(cookie);
+    return counted;
+}
+
+void stats_merge(Stats_t *into, const Stats_t *from)
+{
+    pthread_mutex_lock(&merge_lock);
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        into->phases[i].wall += from->phases[i].wall;
+        into->phases[i].cpu += from->phases[i].cpu;
+        into->phase_bytes[i] += from->phase_bytes[i];
+        into->ran[i] |= from->ran[i];
+    }
+    into->files += from->files;
+    into->bytes_in += from->bytes_in;
+    into->bytes_out += from->bytes_out;
+    for (int i = 0; i < TAG_TYPES; i++)
+        into->tags[i] += from->tags[i];
+    if (from->max_depth > into->max_depth)
+        into->max_depth = from->max_depth;
+
+    pthread_mutex_unlock(&merge_lock);
+}
+
+void stats_print(const Stats_t *stats, int format, double elapsed,
+                 FILE *stream)
+{
+    size_t total = 0;
+    for (int i = 0; i < TAG_TYPES; i++)
+        total += stats->tags[i];
+
+    if (format == STATS_JSON) {
+        fprintf(stream,
+                "{\"files\":%zu,\"elapsed_ms\":%.3f,\"bytes_in\":%zu,"
+                "\"bytes_out\":%zu,\"phases\":{",
+                stats->files, elapsed * 1e3, stats->bytes_in,
+                stats->bytes_out);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(stream,
+                    "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+                    "\"bytes\":%zu}",
+                    i ? "," : "", phase_names[i],
+                    stats->phases[i].wall * 1e3,
+                    stats->phases[i].cpu * 1e3, stats->phase_bytes[i]);
+        }
+        fprintf(stream, "},\"tags\":{\"total\":%zu", total);
+        for (int i = 1; i < TAG_TYPES; i++)
+            fprintf(stream, ",\"%s\":%zu", type_strings[i], stats->tags[i]);
+        fprintf(stream, "},\"max_depth\":%zu,\"peak_rss_kib\":%zu",
+                stats->max_depth, peak_rss());
+#ifdef AST_ACCOUNTING
+        print_accounting(format, stream);
+#endif
+        fprintf(stream, "}\n");
+        return;
+    }
+
+    fprintf(stream, "Stats: %zu file%s in %.2f ms, %zu bytes in, "
+            "%zu bytes out", stats->files, stats->files == 1 ? "" : "s",
+            elapsed * 1e3, stats->bytes_in, stats->bytes_out);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (!stats->ran[i])
+            continue;
+        double wall = stats->phases[i].wall;
+        fprintf(stream, ", %s %.2f ms (cpu %.2f ms, %.1f MB/s)",
+                phase_names[i], wall * 1e3, stats->phases[i].cpu * 1e3,
+                wall > 0 ? stats->phase_bytes[i] / wall / 1e6 : 0);
+    }
+    fprintf(stream, ", %zu tags (", total);
+    for (int i = 1, first = 1; i < TAG_TYPES; i++) {
+        if (!stats->tags[i])
+            continue;
+        fprintf(stream, "%s%s %zu", first ? "" : ", ", type_strings[i],
+                stats->tags[i]);
+        first = 0;
+    }
+    fprintf(stream, "), max depth %zu, peak RSS %zu KiB",
+            stats->max_depth, peak_rss());
+#ifdef AST_ACCOUNTING
+    print_accounting(format, stream);
+#endif
+    fprintf(stream, "\n");
+}
+
+#ifdef AST_ACCOUNTING
+// Live counts are what is still allocated, so they should read zero here
+static void print_accounting(int format, FILE *stream)
+{
+    Alloc_counter_t counters[ALLOC_KINDS];
+    size_t peak = ast_accounting(counters);
+
+    if (format == STATS_JSON)
+        fprintf(stream, ",\"memory\":{\"peak_bytes\":%zu", peak);
+    else
+        fprintf(stream, ", tree peak %zu bytes (", peak);
+
+    for (int i = 1, first = 1; i < ALLOC_KINDS; i++) {
+        const Alloc_counter_t *counter = counters + i;
+        const char *name =
+            i < TAG_TYPES ? type_strings[i] : alloc_names[i - TAG_TYPES];
+
+        if (format == STATS_JSON) {
+            fprintf(stream,
+                    ",\"%s\":{\"live_bytes\":%zu,\"live_objects\":%zu,"
+                    "\"peak_bytes\":%zu,\"total_bytes\":%zu,"
+                    "\"total_objects\":%zu}",
+                    name, counter->bytes, counter->objects,
+                    counter->peak_bytes, counter->total_bytes,
+                    counter->total_objects);
+        }
+        else if (counter->total_objects) {
+            fprintf(stream, "%s%s %zu objects, peak %zu bytes",
+                    first ? "" : ", ", name, counter->total_objects,
+                    counter->peak_bytes);
+            first = 0;
+        }
+    }
+    fprintf(stream, format == STATS_JSON ? "}" : ")");
+}
+#endif
+
+static void count_tree(Stats_t *stats, Tag_t *root, uint8_t type)
+{
+    size_t base = walk_depth();
+
+    stats->tags[type]++;
+    if (stats->max_depth < 1)
+        stats->max_depth = 1;
+    if (type != TAG_Compound && type != TAG_List)
+        return;
+    walk_push(type, root);
+
+    while (walk_depth() > base) {
+        Walk_frame_t *frame = walk_top();
+        size_t depth = walk_depth() - base + 1;
+        Tag_t *child;
+
+        if (frame->type == TAG_Compound) {
+            Tag_compound_t *tag = (Tag_compound_t *) frame->tag;
+            Named_tag_t *member = tag->load[frame->index++];
+            if (!member) {
+                walk_pop();
+                continue;
+            }
+            child = member->tag;
+            type = member->type;
+        }
+        else {
+            Tag_list_t *tag = (Tag_list_t *) frame->tag;
+            if (frame->index == tag->length) {
+                walk_pop();
+                continue;
+            }
+            child = tag->load[frame->index++];
+            type = tag->list_type;
+        }
+
+        stats->tags[type]++;
+        if (depth > stats->max_depth)
+            stats->max_depth = depth;
+        if (type == TAG_Compound || type == TAG_List)
+            walk_push(type, child);
+    }
+}
+
+static ssize_t counted_write(void *cookie, const char *data, size_t size)
+{
+    Counted_stream_t *counted = (Counted_stream_t *) cookie;
+    size_t written = fwrite(data, 1, size, counted->stream);
+
+    *counted->count += written;
+    return written ? (ssize_t) written : -1;
+}
+
+static int counted_close(void *cookie)
+{
+    free(cookie);
+    return 0;
+}
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t peak_rss()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return usage.ru_maxrss;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Text roots that aren't compounds are refused unless roots are nameless, and
+# -p agrees with -p -c on every one of them.
+
+viewer=${1:-./nbt_viewer}
+failed=0
+
+# Expects the given status from both converting to text and to binary
+check()
+{
+    expected=$1
+    text=$2
+    shift 2
+    printf '%s' "$text" | "$viewer" "$@" -p - >/dev/null 2>&1
+    printed=$?
+    printf '%s' "$text" | "$viewer" "$@" -p -c - >/dev/null 2>&1
+    written=$?
+    if [ "$printed" -ne "$expected" ] || [ "$written" -ne "$expected" ]; then
+        echo "FAIL: '$text' $*: -p gave $printed, -p -c gave $written," \
+             "expected $expected"
+        failed=1
+    fi
+}
+
+check 0   '{a:1}'
+check 0   'x:{a:1}'
+check 255 '[1,2,3]'
+check 255 'a:[1,2]'
+check 255 '5b'
+check 0   '{a:1}'   --nameless
+check 0   '[1,2,3]' --nameless
+check 0   'a:[1,2]' --nameless
+check 0   '5b'      --nameless
+
+# A nameless list root is written as its type followed by its payload
+bytes=$(printf '[1,2]' | "$viewer" --nameless -p -c - | gzip -dc | od -An -tx1 |
+        tr -d ' \n')
+if [ "$bytes" != "0903000000020000000100000002" ]; then
+    echo "FAIL: nameless [1,2] was written as $bytes"
+    failed=1
+fi
+
+[ "$failed" -eq 0 ] && echo "All root tests passed."
+exit $failed